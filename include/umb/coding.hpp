@@ -22,17 +22,25 @@
 // TODO: when encoding dynamic fields, truncate fields longer
 //  than maximum size silently? Better than returning an error?
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <charconv>
 #include <concepts>
+#include <cstring>
+#include <expected>
 #include <format>
 #include <functional>
 #include <limits>
+#include <memory>
 #include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
 #include "umb/constants.hpp"
+#include "umb/inline_vector.hpp"
 
 static_assert(sizeof(float) * std::numeric_limits<unsigned char>::digits == 32,
               "require 32 bits floats");
@@ -43,9 +51,316 @@ namespace umb
 template<typename T = bool>
 concept BoolType = std::is_convertible_v<T, bool>;
 
-// TODO: instead of throwing, use std::expected?
-//   - decoding functions should return std::expected<DECODED_TYPE, ERROR_CODE>
-//   - how to deal with encoding errors? just return the code without std::expected?
+/**
+ * Load a little-endian \T from \p. \p does not need to be aligned.
+ * On little-endian hosts this compiles to a single unaligned load.
+ *
+ * @param p pointer to the first byte of the value.
+ * @return the loaded value in host byte order.
+ */
+template<std::integral T>
+[[nodiscard]] inline constexpr T
+load_le(const byte* p) noexcept
+{
+    if constexpr (std::endian::native == std::endian::little
+                  || std::endian::native == std::endian::big)
+    {
+        std::array<byte, sizeof(T)> raw{};
+        std::copy_n(p, sizeof(T), raw.begin());
+        const auto v = std::bit_cast<T>(raw);
+        if constexpr (std::endian::native == std::endian::big)
+        {
+            return std::byteswap(v);
+        }
+        else
+        {
+            return v;
+        }
+    }
+    else
+    {
+        // Portable fallback for mixed-endian hosts.
+        using U = std::make_unsigned_t<T>;
+        U v = 0;
+        for (std::size_t j = 0; j < sizeof(T); ++j)
+        {
+            v = static_cast<U>(v | (static_cast<U>(p[j]) << (j * 8)));
+        }
+        return static_cast<T>(v);
+    }
+}
+
+/**
+ * Store \v to \p in little-endian byte order. \p does not need to be
+ * aligned. On little-endian hosts this compiles to a single unaligned store.
+ *
+ * @param v input value to store.
+ * @param p pointer to the first output byte.
+ */
+template<std::integral T>
+inline constexpr void
+store_le(T v, byte* p) noexcept
+{
+    if constexpr (std::endian::native == std::endian::little
+                  || std::endian::native == std::endian::big)
+    {
+        if constexpr (std::endian::native == std::endian::big)
+        {
+            v = std::byteswap(v);
+        }
+        const auto raw = std::bit_cast<std::array<byte, sizeof(T)>>(v);
+        std::copy_n(raw.cbegin(), sizeof(T), p);
+    }
+    else
+    {
+        // Portable fallback for mixed-endian hosts.
+        using U = std::make_unsigned_t<T>;
+        const auto u = static_cast<U>(v);
+        for (std::size_t j = 0; j < sizeof(T); ++j)
+        {
+            p[j] = static_cast<byte>(u >> (j * 8));
+        }
+    }
+}
+
+/**
+ * Copy \n UCS-2 characters from little-endian wire bytes in \src to \dst.
+ * On little-endian hosts the wire format matches the in-memory layout
+ * of char16_t, so this is a single memcpy.
+ *
+ * @param src pointer to the first wire byte.
+ * @param dst output characters.
+ * @param n number of characters to copy.
+ */
+inline constexpr void
+load_ucs2_le(const byte* src, char16_t* dst, std::size_t n) noexcept
+{
+    if !consteval
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            std::memcpy(dst, src, n * g_sizeof_uscript_char);
+            return;
+        }
+    }
+
+    for (std::size_t j = 0; j < n; ++j)
+    {
+        dst[j] = static_cast<char16_t>(load_le<uint16_t>(src + j * g_sizeof_uscript_char));
+    }
+}
+
+/**
+ * Copy \n UCS-2 characters from \src to \dst as little-endian wire bytes.
+ * \See load_ucs2_le.
+ *
+ * @param src input characters.
+ * @param dst pointer to the first output wire byte.
+ * @param n number of characters to copy.
+ */
+inline constexpr void
+store_ucs2_le(const char16_t* src, byte* dst, std::size_t n) noexcept
+{
+    if !consteval
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            std::memcpy(dst, src, n * g_sizeof_uscript_char);
+            return;
+        }
+    }
+
+    for (std::size_t j = 0; j < n; ++j)
+    {
+        store_le(static_cast<uint16_t>(src[j]), dst + j * g_sizeof_uscript_char);
+    }
+}
+
+/**
+ * Fixed capacity inline storage for the intermediate string
+ * representation of a float. \See encode_float.
+ */
+class FloatString
+{
+public:
+    constexpr FloatString() noexcept = default;
+
+    constexpr FloatString(std::string_view str) noexcept
+    {
+        assign(str);
+    }
+
+    /**
+     * Replace the contents with \str. \str is truncated
+     * to \capacity characters.
+     */
+    constexpr void assign(std::string_view str) noexcept
+    {
+        m_size = static_cast<byte>(std::min(str.size(), capacity()));
+        std::copy_n(str.cbegin(), m_size, m_data.begin());
+    }
+
+    constexpr void clear() noexcept
+    {
+        m_size = 0;
+    }
+
+    [[nodiscard]] constexpr const char* data() const noexcept
+    {
+        return m_data.data();
+    }
+
+    [[nodiscard]] constexpr std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    [[nodiscard]] static constexpr std::size_t capacity() noexcept
+    {
+        return g_max_float_str_size;
+    }
+
+    [[nodiscard]] constexpr std::string_view view() const noexcept
+    {
+        return {m_data.data(), m_size};
+    }
+
+    constexpr operator std::string_view() const noexcept
+    {
+        return view();
+    }
+
+    [[nodiscard]] constexpr bool operator==(const FloatString& other) const noexcept
+    {
+        return view() == other.view();
+    }
+
+private:
+    std::array<char, g_max_float_str_size> m_data{};
+    byte m_size{0};
+};
+
+/**
+ * Encode a float into its intermediate encoded string format.
+ * Writes the shortest string that round-trips back to \f, in plain
+ * or scientific notation, whichever is shorter. Both notations are
+ * parsed by UnrealScript's float(FloatStr) conversion.
+ * The output of this function can be consumed by \encode_float_str
+ * to encode the string into its final UMB wire format.
+ *
+ * @param f input float to encode.
+ * @param out output string to write the result to.
+ */
+inline UMB_CONSTEXPR void
+encode_float(float f, FloatString& out)
+{
+    std::array<char, g_max_float_str_size> buf;
+    const auto [ptr, ec] = std::to_chars(buf.data(), buf.data() + buf.size(), f);
+    if (ec == std::errc())
+    {
+        out.assign({buf.data(), ptr});
+    }
+    else
+    {
+        throw std::runtime_error(
+            std::format("TODO: better handling: {}, {}", f,
+                        std::make_error_condition(ec).message()));
+    }
+}
+
+// TODO: how to deal with encoding errors? just return the code without std::expected?
+
+/**
+ * Error codes returned by the non-throwing try_decode_* functions.
+ */
+enum class DecodeError : uint8_t
+{
+    // Input ended before the value being decoded.
+    not_enough_bytes,
+    // Float string payload could not be parsed as a float.
+    invalid_float,
+    // Dynamic field is longer than the capacity of its inline storage.
+    capacity_exceeded,
+    // Packet header contains a message type that is not known to the decoder.
+    unknown_message_type,
+    // Message type is known, but no handler is registered for it.
+    unhandled_message_type,
+};
+
+[[nodiscard]] inline constexpr std::string_view
+to_string(DecodeError error) noexcept
+{
+    switch (error)
+    {
+        case DecodeError::not_enough_bytes:
+            return "not enough bytes";
+        case DecodeError::invalid_float:
+            return "invalid float";
+        case DecodeError::capacity_exceeded:
+            return "capacity exceeded";
+        case DecodeError::unknown_message_type:
+            return "unknown message type";
+        case DecodeError::unhandled_message_type:
+            return "unhandled message type";
+        default:
+            return "unknown error";
+    }
+}
+
+/**
+ * Describes why decoding a whole message failed.
+ */
+struct MessageDecodeError
+{
+    DecodeError error{};
+    // Name of the field that failed to decode. Points to
+    // static storage. Empty if the packet header is invalid.
+    std::string_view field{};
+    // Offset of the failing field from the start of the input bytes.
+    std::size_t offset{0};
+};
+
+using DecodeResult = std::expected<void, DecodeError>;
+using MessageDecodeResult = std::expected<void, MessageDecodeError>;
+
+/**
+ * Create an error result for a message field that failed to decode.
+ *
+ * @param error reason the field failed to decode.
+ * @param field name of the field.
+ * @param bytes input UMB packet bytes being decoded.
+ * @param field_begin iterator to the start of the field in \bytes.
+ */
+inline constexpr MessageDecodeResult
+field_error(
+    DecodeError error,
+    std::string_view field,
+    const std::span<const byte> bytes,
+    const std::span<const byte>::const_iterator& field_begin) noexcept
+{
+    return std::unexpected(MessageDecodeError{
+        .error = error,
+        .field = field,
+        .offset = static_cast<std::size_t>(std::distance(bytes.cbegin(), field_begin)),
+    });
+}
+
+/**
+ * Create an error result for a message field that failed to decode.
+ *
+ * @param error reason the field failed to decode.
+ * @param field name of the field.
+ * @param offset offset of the field from the start of the message.
+ */
+inline constexpr MessageDecodeResult
+field_error(DecodeError error, std::string_view field, std::size_t offset) noexcept
+{
+    return std::unexpected(MessageDecodeError{
+        .error = error,
+        .field = field,
+        .offset = offset,
+    });
+}
 
 template<typename T = const byte>
 inline constexpr bool
@@ -90,7 +405,7 @@ check_bounds(
     const typename std::span<T>::const_iterator& i,
     const std::span<T> bytes,
     std::size_t field_size,
-    const std::string& caller = __builtin_FUNCTION())
+    const char* caller = __builtin_FUNCTION())
 {
     if (!check_bounds_no_throw(i, bytes, field_size))
     {
@@ -109,7 +424,7 @@ check_bounds(
     const typename std::span<T>::const_iterator&& i,
     const std::span<T> bytes,
     std::size_t field_size,
-    const std::string& caller = __builtin_FUNCTION())
+    const char* caller = __builtin_FUNCTION())
 {
     check_bounds(
         std::forward<const typename std::span<T>::const_iterator>(i),
@@ -129,70 +444,280 @@ check_dynamic_length(std::size_t str_size)
     }
 }
 
+// String type of heap backed string fields. Decoding functions accept any
+// allocator, e.g. both std::u16string and std::pmr::u16string.
+template<typename Alloc>
+using basic_u16string = std::basic_string<char16_t, std::char_traits<char16_t>, Alloc>;
+
+// Unchecked decoding functions. These perform no bounds checking
+// and must only be called on input that is already known to hold
+// enough bytes for the value being decoded, e.g. input that has
+// passed a generated Message::validate_size check.
+
 inline constexpr void
-decode_bool(
+decode_bool_unchecked(
     std::span<const byte>::const_iterator& i,
-    const std::span<const byte> bytes,
-    bool& out)
+    bool& out) noexcept
 {
-    check_bounds(i, bytes, g_sizeof_byte);
     out = *i++;
 }
 
-template<BoolType B, std::integral T>
+/**
+ * Decode \out bools packed as bit fields in ceil(sizeof...(out) / 8)
+ * bytes without bounds checking. \See encode_packed_bools.
+ *
+ * @param i input byte iterator to current position.
+ * @param out output bools to write the decoded results to.
+ */
+template<BoolType... Bools>
+inline constexpr void
+decode_packed_bools_unchecked(
+    std::span<const byte>::const_iterator& i,
+    Bools& ... out) noexcept
+{
+    byte b = *i++;
+    std::size_t index = 0;
+
+    ([&]
+    {
+        // Only move to the next byte if there are bools left to read.
+        if (index == g_bools_in_byte)
+        {
+            b = *i++;
+            index = 0;
+        }
+        out = static_cast<bool>(b & (1 << index++));
+    }(), ...);
+}
+
 inline constexpr void
-_read_bool_single_byte(
-    byte b,
-    T& index,
-    B& out)
+decode_uint16_unchecked(
+    std::span<const byte>::const_iterator& i,
+    uint16_t& out) noexcept
 {
-    out = static_cast<bool>(b & 1 << index++);
+    out = load_le<uint16_t>(std::to_address(i));
+    std::advance(i, g_sizeof_uint16);
 }
 
-template<BoolType B, std::integral T>
 inline constexpr void
-_read_bool_many_bytes(
-    byte& b,
-    T& index,
-    B& out,
-    std::span<const byte>::const_iterator& i)
+decode_int32_unchecked(
+    std::span<const byte>::const_iterator& i,
+    int32_t& out) noexcept
+{
+    out = load_le<int32_t>(std::to_address(i));
+    std::advance(i, g_sizeof_int32);
+}
+
+inline constexpr void
+decode_byte_unchecked(
+    std::span<const byte>::const_iterator& i,
+    byte& out) noexcept
 {
-    _read_bool_single_byte(b, index, out);
-    if ((index % g_bools_in_byte) == 0)
+    out = *i++;
+}
+
+/**
+ * Decode a UMB packet header with a single 32 bit load
+ * without bounds checking. \See encode_header.
+ *
+ * @param i input byte iterator to current position.
+ * @param size output total packet size.
+ * @param part output packet part field.
+ * @param type output message type.
+ */
+inline constexpr void
+decode_header_unchecked(
+    std::span<const byte>::const_iterator& i,
+    byte& size,
+    byte& part,
+    uint16_t& type) noexcept
+{
+    static_assert(g_header_size == sizeof(uint32_t));
+    const auto header = load_le<uint32_t>(std::to_address(i));
+    std::advance(i, g_header_size);
+    size = static_cast<byte>(header);
+    part = static_cast<byte>(header >> 8);
+    type = static_cast<uint16_t>(header >> 16);
+}
+
+/**
+ * Decode a float from its UMB wire format without bounds checking.
+ * The float string is parsed directly from the input bytes.
+ * It is still validated, since a float string of the correct
+ * size can contain arbitrary garbage.
+ * \see decode_float.
+ *
+ * @param i input byte iterator to current position.
+ * @param out output float to write the decoded result to.
+ * @return DecodeError::invalid_float if the float string cannot be
+ *  parsed in full.
+ */
+inline DecodeResult
+decode_float_unchecked(
+    std::span<const byte>::const_iterator& i,
+    float& out) noexcept
+{
+    const byte size = *i++;
+
+    if (size == 0)
+    {
+        out = 0;
+        return {};
+    }
+
+    const auto* float_str = reinterpret_cast<const char*>(std::to_address(i));
+    std::advance(i, size);
+
+    float f;
+    const auto [ptr, ec] = std::from_chars(float_str, float_str + size, f);
+    // Trailing garbage after a valid prefix is not a float either.
+    if (ec != std::errc() || ptr != float_str + size)
     {
-        b = *i++;
-        index = 0;
+        return std::unexpected(DecodeError::invalid_float);
     }
+
+    out = f;
+    return {};
 }
 
-template<BoolType... Bools>
-inline constexpr void
-decode_packed_bools(
+/**
+ * Decode UMB wire format string of 16-bit characters into
+ * a string object without bounds checking. \See decode_string.
+ *
+ * @param i input byte iterator to current position.
+ * @param out output string to write the decode result to.
+ */
+template<typename Alloc>
+inline UMB_CONSTEXPR void
+decode_string_unchecked(
     std::span<const byte>::const_iterator& i,
-    const std::span<const byte> bytes,
-    Bools& ... out)
+    basic_u16string<Alloc>& out)
 {
-    constexpr std::size_t num_bools = sizeof...(out);
-    constexpr std::size_t bytes_to_read = (num_bools / g_bools_in_byte) + 1;
-    check_bounds(i, bytes, bytes_to_read);
-    auto b = *i++;
-    std::size_t index = 0;
+    const byte str_size = *i++;
+    const auto* src = std::to_address(i);
 
-    // Get bit as bool.
-    if constexpr (bytes_to_read > 1)
+    out.resize_and_overwrite(str_size, [src](char16_t* dst, std::size_t n) noexcept
     {
-        ([&]
+        load_ucs2_le(src, dst, n);
+        return n;
+    });
+    std::advance(i, str_size * g_sizeof_uscript_char);
+}
+
+/**
+ * Decode a dynamic UMB wire format byte sequence into
+ * a byte sequence without bounds checking. \See decode_bytes.
+ *
+ * @param i input byte iterator to current position.
+ * @param out output vector to write decoded bytes to.
+ */
+template<typename Alloc>
+inline UMB_CONSTEXPR void
+decode_bytes_unchecked(
+    std::span<const byte>::const_iterator& i,
+    std::vector<byte, Alloc>& out)
+{
+    const byte size = *i++;
+    out.assign(i, i + size);
+    std::advance(i, size);
+}
+
+/**
+ * Decode UMB wire format string of 16-bit characters into fixed
+ * capacity inline storage without bounds checking. \See decode_string.
+ *
+ * @param i input byte iterator to current position.
+ * @param out output string to write the decode result to.
+ * @return DecodeError::capacity_exceeded if the string does not fit in \out.
+ */
+template<std::size_t N>
+inline constexpr DecodeResult
+decode_string_unchecked(
+    std::span<const byte>::const_iterator& i,
+    InlineString<N>& out) noexcept
+{
+    const byte str_size = *i;
+    if constexpr (N < g_max_dynamic_size)
+    {
+        if (str_size > N)
         {
-            _read_bool_many_bytes(b, index, out, i);
-        }(), ...);
+            return std::unexpected(DecodeError::capacity_exceeded);
+        }
     }
-    else
+    ++i;
+
+    load_ucs2_le(std::to_address(i), out.data(), str_size);
+    out.resize_for_overwrite(str_size);
+    std::advance(i, str_size * g_sizeof_uscript_char);
+    return {};
+}
+
+/**
+ * Decode a dynamic UMB wire format byte sequence into fixed
+ * capacity inline storage without bounds checking. \See decode_bytes.
+ *
+ * @param i input byte iterator to current position.
+ * @param out output bytes to write the decode result to.
+ * @return DecodeError::capacity_exceeded if the bytes do not fit in \out.
+ */
+template<std::size_t N>
+inline constexpr DecodeResult
+decode_bytes_unchecked(
+    std::span<const byte>::const_iterator& i,
+    InlineBytes<N>& out) noexcept
+{
+    const byte size = *i;
+    if constexpr (N < g_max_dynamic_size)
     {
-        ([&]
+        if (size > N)
         {
-            _read_bool_single_byte(b, index, out);
-        }(), ...);
+            return std::unexpected(DecodeError::capacity_exceeded);
+        }
     }
+    ++i;
+
+    std::copy_n(i, size, out.data());
+    out.resize_for_overwrite(size);
+    std::advance(i, size);
+    return {};
+}
+
+/**
+ * Return the number of bytes a dynamic field starting at \i takes,
+ * including the size header. \i must point to a valid size header.
+ *
+ * @param i input byte iterator to the size header of the field.
+ * @param element_size size of a single element of the field in bytes.
+ */
+inline constexpr std::size_t
+dynamic_field_size_unchecked(
+    const std::span<const byte>::const_iterator& i,
+    std::size_t element_size) noexcept
+{
+    return g_dynamic_field_header_size + (*i * element_size);
+}
+
+inline constexpr void
+decode_bool(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    bool& out)
+{
+    check_bounds(i, bytes, g_sizeof_byte);
+    decode_bool_unchecked(i, out);
+}
+
+template<BoolType... Bools>
+inline constexpr void
+decode_packed_bools(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    Bools& ... out)
+{
+    constexpr std::size_t num_bools = sizeof...(out);
+    constexpr std::size_t bytes_to_read = (num_bools + g_bools_in_byte - 1) / g_bools_in_byte;
+    check_bounds(i, bytes, bytes_to_read);
+    decode_packed_bools_unchecked(i, out...);
 }
 
 inline constexpr void
@@ -202,10 +727,7 @@ decode_uint16(
     uint16_t& out)
 {
     check_bounds(i, bytes, g_sizeof_uint16);
-    out = (
-        static_cast<uint16_t>(*i++)
-        | static_cast<uint16_t>(*i++) << 8
-    );
+    decode_uint16_unchecked(i, out);
 }
 
 inline constexpr void
@@ -215,12 +737,7 @@ decode_int32(
     int32_t& out)
 {
     check_bounds(i, bytes, g_sizeof_int32);
-    out = (
-        static_cast<int32_t>(*i++)
-        | static_cast<int32_t>(*i++) << 8
-        | static_cast<int32_t>(*i++) << 16
-        | static_cast<int32_t>(*i++) << 24
-    );
+    decode_int32_unchecked(i, out);
 }
 
 inline constexpr void
@@ -230,64 +747,33 @@ decode_byte(
     byte& out)
 {
     check_bounds(i, bytes, g_sizeof_byte);
-    out = *i++;
+    decode_byte_unchecked(i, out);
 }
 
 /**
- * Decode a float from its UMB wire format into a
- * float and its intermediate string representation.
+ * Decode a float from its UMB wire format.
  * \see encode_float.
  * \see encode_float_str.
  *
  * @param i input byte iterator to current position in \bytes.
  * @param bytes input UMB packet bytes being decoded.
  * @param out output float to write the decoded result to.
- * @param serialized_float_cache output string to write the float's
- *  intermediate string representation to.
  */
-inline constexpr void
+inline void
 decode_float(
     std::span<const byte>::const_iterator& i,
     const std::span<const byte> bytes,
-    float& out,
-    std::string& serialized_float_cache)
+    float& out)
 {
-    byte size;
-    decode_byte(i, bytes, size);
-
-    if (size == 0)
-    {
-        out = 0;
-        return;
-    }
+    check_bounds(i, bytes, g_dynamic_field_header_size);
+    check_bounds(i, bytes, dynamic_field_size_unchecked(i, g_sizeof_byte));
 
-    check_bounds(i, bytes, size);
-
-    const std::span<const byte> str_bytes{i, i + size};
-    std::advance(i, size);
-
-    std::string float_str;
-    float_str.reserve(size);
-
-    for (const auto& sb: str_bytes)
-    {
-        const char c = static_cast<char>(sb);
-        float_str.append(1, c);
-    }
-
-    float f;
-    const auto [_, ec] = std::from_chars(float_str.data(), float_str.data() + float_str.size(), f);
-    if (ec == std::errc())
-    {
-        out = f;
-        serialized_float_cache = std::move(float_str);
-    }
-    else
+    const auto begin = i;
+    if (!decode_float_unchecked(i, out))
     {
+        const std::string float_str{begin + g_dynamic_field_header_size, i};
         throw std::runtime_error(
-            std::format("TODO: decode_float: better handling: {}: '{}'",
-                        std::make_error_condition(ec).message(),
-                        float_str));
+            std::format("TODO: decode_float: better handling: '{}'", float_str));
     }
 }
 
@@ -300,131 +786,283 @@ decode_float(
  * @param bytes input UMB packet bytes being decoded.
  * @param out output string to write the decode result to.
  */
-inline constexpr void
+template<typename Alloc>
+inline UMB_CONSTEXPR void
 decode_string(
     std::span<const byte>::const_iterator& i,
     const std::span<const byte> bytes,
-    std::u16string& out)
+    basic_u16string<Alloc>& out)
+{
+    check_bounds(i, bytes, g_dynamic_field_header_size);
+    check_bounds(i, bytes, dynamic_field_size_unchecked(i, g_sizeof_uscript_char));
+    decode_string_unchecked(i, out);
+}
+
+/**
+ * Decode a dynamic UMB wire format byte sequence
+ * (header + payload) into a byte sequence.
+ *
+ * @param i input byte iterator to current position in \bytes.
+ * @param bytes input UMB packet bytes being decoded.
+ * @param out output vector to write decoded bytes to.
+ */
+template<typename Alloc>
+inline UMB_CONSTEXPR void
+decode_bytes(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    std::vector<byte, Alloc>& out)
 {
-    byte str_size;
-    decode_byte(i, bytes, str_size);
+    check_bounds(i, bytes, g_dynamic_field_header_size);
+    check_bounds(i, bytes, dynamic_field_size_unchecked(i, g_sizeof_byte));
+    decode_bytes_unchecked(i, out);
+}
 
-    if (str_size == 0)
+// Non-throwing decoding functions. These mirror the decode_* functions
+// above, but report errors by returning DecodeResult instead of throwing.
+// On error, \i and \out are left in an unspecified state.
+
+inline constexpr DecodeResult
+try_decode_bool(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    bool& out) noexcept
+{
+    if (!check_bounds_no_throw(i, bytes, g_sizeof_byte))
     {
-        out.clear();
-        return;
+        return std::unexpected(DecodeError::not_enough_bytes);
     }
+    decode_bool_unchecked(i, out);
+    return {};
+}
 
-    const auto payload_size = str_size * g_sizeof_uscript_char;
-    check_bounds(i, bytes, payload_size);
+template<BoolType... Bools>
+inline constexpr DecodeResult
+try_decode_packed_bools(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    Bools& ... out) noexcept
+{
+    constexpr std::size_t num_bools = sizeof...(out);
+    constexpr std::size_t bytes_to_read = (num_bools + g_bools_in_byte - 1) / g_bools_in_byte;
+    if (!check_bounds_no_throw(i, bytes, bytes_to_read))
+    {
+        return std::unexpected(DecodeError::not_enough_bytes);
+    }
+    decode_packed_bools_unchecked(i, out...);
+    return {};
+}
 
-    const auto ps = static_cast<std::span<const byte>::difference_type>(payload_size);
-    const std::span<const byte> byte_buf{i, i + ps};
-    std::advance(i, ps);
+inline constexpr DecodeResult
+try_decode_uint16(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    uint16_t& out) noexcept
+{
+    if (!check_bounds_no_throw(i, bytes, g_sizeof_uint16))
+    {
+        return std::unexpected(DecodeError::not_enough_bytes);
+    }
+    decode_uint16_unchecked(i, out);
+    return {};
+}
 
-    std::vector<char16_t> char_buf;
-    char_buf.reserve(str_size);
+inline constexpr DecodeResult
+try_decode_int32(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    int32_t& out) noexcept
+{
+    if (!check_bounds_no_throw(i, bytes, g_sizeof_int32))
+    {
+        return std::unexpected(DecodeError::not_enough_bytes);
+    }
+    decode_int32_unchecked(i, out);
+    return {};
+}
 
-    char16_t previous = 0x00;
-    byte shift = 0;
-    for (const auto& bb: byte_buf)
+inline constexpr DecodeResult
+try_decode_byte(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    byte& out) noexcept
+{
+    if (!check_bounds_no_throw(i, bytes, g_sizeof_byte))
     {
-        if (shift == 8)
-        {
-            char_buf.emplace_back(static_cast<char16_t>(previous | (bb << shift)));
-        }
-        else
-        {
-            previous = static_cast<char16_t>(bb);
-        }
-        // [0, 8, 0, 8, 0, 8, ...]
-        shift = (shift + 8) % 16;
+        return std::unexpected(DecodeError::not_enough_bytes);
     }
+    decode_byte_unchecked(i, out);
+    return {};
+}
 
-    out.clear();
-    out.reserve(str_size);
-    out.append(char_buf.data(), char_buf.size());
+/**
+ * Check that \bytes holds a complete dynamic field starting at \i.
+ *
+ * @param i input byte iterator to the size header of the field.
+ * @param bytes input UMB packet bytes being decoded.
+ * @param element_size size of a single element of the field in bytes.
+ */
+inline constexpr bool
+check_dynamic_field_bounds_no_throw(
+    const std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    std::size_t element_size) noexcept
+{
+    return check_bounds_no_throw(i, bytes, g_dynamic_field_header_size)
+           && check_bounds_no_throw(i, bytes, dynamic_field_size_unchecked(i, element_size));
 }
 
 /**
- * Decode a dynamic UMB wire format byte sequence
- * (header + payload) into a byte sequence.
+ * Non-throwing version of \decode_float.
  *
  * @param i input byte iterator to current position in \bytes.
  * @param bytes input UMB packet bytes being decoded.
- * @param out output vector to write decoded bytes to.
+ * @param out output float to write the decoded result to.
+ * @return DecodeError::not_enough_bytes if \bytes ends before the float,
+ *  DecodeError::invalid_float if the float string cannot be parsed.
  */
-inline constexpr void
-decode_bytes(
+inline DecodeResult
+try_decode_float(
     std::span<const byte>::const_iterator& i,
     const std::span<const byte> bytes,
-    std::vector<byte>& out)
+    float& out) noexcept
 {
-    byte size;
-    decode_byte(i, bytes, size);
+    if (!check_dynamic_field_bounds_no_throw(i, bytes, g_sizeof_byte))
+    {
+        return std::unexpected(DecodeError::not_enough_bytes);
+    }
+    return decode_float_unchecked(i, out);
+}
 
-    if (size == 0)
+/**
+ * Non-throwing version of \decode_string.
+ *
+ * @param i input byte iterator to current position in \bytes.
+ * @param bytes input UMB packet bytes being decoded.
+ * @param out output string to write the decode result to.
+ * @return DecodeError::not_enough_bytes if \bytes ends before the string.
+ */
+template<typename Alloc>
+inline UMB_CONSTEXPR DecodeResult
+try_decode_string(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    basic_u16string<Alloc>& out)
+{
+    if (!check_dynamic_field_bounds_no_throw(i, bytes, g_sizeof_uscript_char))
     {
-        out.clear();
-        return;
+        return std::unexpected(DecodeError::not_enough_bytes);
     }
+    decode_string_unchecked(i, out);
+    return {};
+}
 
-    check_bounds(i, bytes, size);
-    std::vector<byte> b;
-    b.reserve(size);
-    while (i != bytes.cend() && b.size() < size)
+/**
+ * Non-throwing version of \decode_bytes.
+ *
+ * @param i input byte iterator to current position in \bytes.
+ * @param bytes input UMB packet bytes being decoded.
+ * @param out output vector to write decoded bytes to.
+ * @return DecodeError::not_enough_bytes if \bytes ends before the payload.
+ */
+template<typename Alloc>
+inline UMB_CONSTEXPR DecodeResult
+try_decode_bytes(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    std::vector<byte, Alloc>& out)
+{
+    if (!check_dynamic_field_bounds_no_throw(i, bytes, g_sizeof_byte))
     {
-        b.emplace_back(*i++);
+        return std::unexpected(DecodeError::not_enough_bytes);
     }
-    out = std::move(b);
+    decode_bytes_unchecked(i, out);
+    return {};
 }
 
-inline constexpr void
-encode_bool(bool b, std::span<byte>::iterator& bytes)
+/**
+ * Non-throwing version of \decode_string for fixed capacity inline storage.
+ *
+ * @param i input byte iterator to current position in \bytes.
+ * @param bytes input UMB packet bytes being decoded.
+ * @param out output string to write the decode result to.
+ * @return DecodeError::not_enough_bytes if \bytes ends before the string,
+ *  DecodeError::capacity_exceeded if the string does not fit in \out.
+ */
+template<std::size_t N>
+inline constexpr DecodeResult
+try_decode_string(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    InlineString<N>& out) noexcept
 {
-    *bytes++ = b;
+    if (!check_dynamic_field_bounds_no_throw(i, bytes, g_sizeof_uscript_char))
+    {
+        return std::unexpected(DecodeError::not_enough_bytes);
+    }
+    return decode_string_unchecked(i, out);
+}
+
+/**
+ * Non-throwing version of \decode_bytes for fixed capacity inline storage.
+ *
+ * @param i input byte iterator to current position in \bytes.
+ * @param bytes input UMB packet bytes being decoded.
+ * @param out output bytes to write the decode result to.
+ * @return DecodeError::not_enough_bytes if \bytes ends before the payload,
+ *  DecodeError::capacity_exceeded if the payload does not fit in \out.
+ */
+template<std::size_t N>
+inline constexpr DecodeResult
+try_decode_bytes(
+    std::span<const byte>::const_iterator& i,
+    const std::span<const byte> bytes,
+    InlineBytes<N>& out) noexcept
+{
+    if (!check_dynamic_field_bounds_no_throw(i, bytes, g_sizeof_byte))
+    {
+        return std::unexpected(DecodeError::not_enough_bytes);
+    }
+    return decode_bytes_unchecked(i, out);
 }
 
-template<BoolType B, std::integral T>
 inline constexpr void
-_write_bool_single_byte(
-    std::reference_wrapper<byte> byte_out,
-    T& index,
-    B in)
+encode_bool(bool b, std::span<byte>::iterator& bytes)
 {
-    const auto set_bit = static_cast<byte>(in) << index++;
-    byte_out.get() |= set_bit;
+    *bytes++ = b;
 }
 
 // TODO: this has to use different parameter order due to how parameter packs work.
 // TODO: normalize signatures across all encoding functions to take the iterator first?
+/**
+ * Encode \bools as bit fields packed into ceil(sizeof...(bools) / 8) bytes.
+ * The output bytes are overwritten, they do not need to be zeroed beforehand.
+ *
+ * @param bytes output iterator to write encoded bytes to.
+ * @param bools input bools to encode.
+ */
 template<BoolType... Bools>
 inline constexpr void
 encode_packed_bools(std::span<byte>::iterator& bytes, Bools... bools)
 {
-    auto byte_out = std::ref(*bytes++);
-    constexpr std::size_t num_bools = sizeof...(bools);
-    constexpr std::size_t bytes_to_write = (num_bools / g_bools_in_byte) + 1;
+    byte b = 0;
     std::size_t index = 0;
 
-    if constexpr (bytes_to_write > 1)
+    ([&]()
     {
-        ([&]()
+        b = static_cast<byte>(b | (static_cast<byte>(bools) << index++));
+        if (index == g_bools_in_byte)
         {
-            _write_bool_single_byte(byte_out, index, bools);
-            if ((index % g_bools_in_byte) == 0)
-            {
-                byte_out = std::ref(*bytes++);
-                index = 0;
-            }
-        }(), ...);
-    }
-    else
+            *bytes++ = b;
+            b = 0;
+            index = 0;
+        }
+    }(), ...);
+
+    // Flush the last partially filled byte.
+    if (index != 0)
     {
-        ([&]()
-        {
-            _write_bool_single_byte(byte_out, index, bools);
-        }(), ...);
+        *bytes++ = b;
     }
 }
 
@@ -449,8 +1087,8 @@ encode_byte(byte b, std::span<byte>::iterator& bytes)
 inline constexpr void
 encode_uint16(uint16_t i, std::span<byte>::iterator& bytes)
 {
-    *bytes++ = i & 0xff;
-    *bytes++ = (i >> 8) & 0xff;
+    store_le(i, std::to_address(bytes));
+    std::advance(bytes, g_sizeof_uint16);
 }
 
 /**
@@ -462,10 +1100,28 @@ encode_uint16(uint16_t i, std::span<byte>::iterator& bytes)
 inline constexpr void
 encode_int32(int32_t i, std::span<byte>::iterator& bytes)
 {
-    *bytes++ = i & 0xff;
-    *bytes++ = (i >> 8) & 0xff;
-    *bytes++ = (i >> 16) & 0xff;
-    *bytes++ = (i >> 24) & 0xff;
+    store_le(i, std::to_address(bytes));
+    std::advance(bytes, g_sizeof_int32);
+}
+
+/**
+ * Encode a UMB packet header with a single 32 bit store.
+ * Header layout is [size:1][part:1][type:2], type in little-endian.
+ *
+ * @param size total packet size including the header.
+ * @param part packet part field.
+ * @param type message type.
+ * @param bytes output iterator to write encoded bytes to.
+ */
+inline constexpr void
+encode_header(byte size, byte part, uint16_t type, std::span<byte>::iterator& bytes)
+{
+    static_assert(g_header_size == sizeof(uint32_t));
+    const auto header = static_cast<uint32_t>(size)
+                        | static_cast<uint32_t>(part) << 8
+                        | static_cast<uint32_t>(type) << 16;
+    store_le(header, std::to_address(bytes));
+    std::advance(bytes, g_header_size);
 }
 
 /**
@@ -477,7 +1133,7 @@ encode_int32(int32_t i, std::span<byte>::iterator& bytes)
  * @param bytes output iterator to write encoded bytes to.
  */
 inline constexpr void
-encode_float_str(const std::string& float_str, std::span<byte>::iterator& bytes)
+encode_float_str(std::string_view float_str, std::span<byte>::iterator& bytes)
 {
     const auto size = float_str.size();
     *bytes++ = static_cast<byte>(size);
@@ -487,39 +1143,6 @@ encode_float_str(const std::string& float_str, std::span<byte>::iterator& bytes)
     }
 }
 
-/**
- * Encode a float into its intermediate encoded string format.
- * The output of this function can be consumed by \encode_float_str
- * to encode the string into its final UMB wire format.
- *
- * @param f input float to encode.
- * @param out output string to write the result to.
- */
-inline UMB_CONSTEXPR void
-encode_float(float f, std::string& out)
-{
-    std::string str;
-    constexpr auto pre = std::numeric_limits<float>::max_digits10;
-    constexpr auto longest_float = std::numeric_limits<float>::digits
-                                   - std::numeric_limits<float>::min_exponent;
-    // Reserve space for longest possible float string + special chars.
-    constexpr auto max_str = longest_float + 8;
-    str.resize(max_str);
-    constexpr auto fmt = std::chars_format::scientific;
-    const auto [ptr, ec] = std::to_chars(str.data(), str.data() + str.size(), f, fmt, pre);
-    if (ec == std::errc())
-    {
-        str.erase(str.find('\0'));
-        out = std::move(str);
-    }
-    else
-    {
-        throw std::runtime_error(
-            std::format("TODO: better handling: {}, {}", f,
-                        std::make_error_condition(ec).message()));
-    }
-}
-
 /**
  * Encode a string of 16-bit characters into its UMB wire format.
  * Effectively a UTF-16 string, but with characters supported in the Unicode
@@ -535,22 +1158,21 @@ encode_float(float f, std::string& out)
  * @param bytes output iterator to write encoded bytes to.
  */
 inline constexpr void
-encode_string(const std::u16string& str, std::span<byte>::iterator& bytes)
+encode_string(const std::u16string_view str, std::span<byte>::iterator& bytes)
 {
     const auto str_size = str.size();
     check_dynamic_length(str_size);
     *bytes++ = static_cast<byte>(str_size);
 
-    if (str_size == 0)
-    {
-        return;
-    }
+    store_ucs2_le(str.data(), std::to_address(bytes), str_size);
+    std::advance(bytes, str_size * g_sizeof_uscript_char);
+}
 
-    for (const char16_t& c: str)
-    {
-        *bytes++ = static_cast<byte>(c & 0xff);
-        *bytes++ = static_cast<byte>((c >> 8) & 0xff);
-    }
+template<std::size_t N>
+inline constexpr void
+encode_string(const InlineString<N>& str, std::span<byte>::iterator& bytes)
+{
+    encode_string(str.view(), bytes);
 }
 
 /**
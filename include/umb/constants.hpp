@@ -77,7 +77,10 @@ constexpr size_t g_bools_in_byte = 8;
 constexpr uint16_t g_max_message_count = std::numeric_limits<uint16_t>::max() - 1;
 
 // Max size of dynamic field payload part.
-constexpr auto g_max_dynamic_size = 255;
+constexpr std::size_t g_max_dynamic_size = 255;
+// Maximum length of the shortest round-trip string representation
+// of a float produced by encode_float, e.g. "-1.00000075e-36".
+constexpr size_t g_max_float_str_size = 15;
 
 // Message part field for single part messages is always constant.
 constexpr auto g_part_single_part = 255;
@@ -123,6 +126,40 @@ static const std::unordered_map<std::string, std::string> g_type_to_cpp_type_arg
     {"string", "const std::u16string_view"},
 };
 
+// Fixed capacity types used for string and bytes fields with inline
+// storage enabled. Instantiated with the field's max_size.
+static const std::unordered_map<std::string, std::string> g_type_to_cpp_inline_type{
+    {"bytes",  "::umb::InlineBytes"},
+    {"string", "::umb::InlineString"},
+};
+
+static const std::unordered_map<std::string, std::string> g_type_to_cpp_inline_type_arg{
+    {"bytes",  "const std::span<const ::umb::byte>"},
+    {"string", "const std::u16string_view"},
+};
+
+// Types used for string and bytes fields when generating with
+// std::pmr allocator support.
+static const std::unordered_map<std::string, std::string> g_type_to_cpp_pmr_type{
+    {"bytes",  "std::pmr::vector<::umb::byte>"},
+    {"string", "std::pmr::u16string"},
+};
+
+static const std::unordered_map<std::string, std::string> g_type_to_cpp_pmr_type_arg{
+    {"bytes",  "const std::span<const ::umb::byte>"},
+    {"string", "const std::u16string_view"},
+};
+
+// Return types of generated read-only message view accessors.
+static const std::unordered_map<std::string, std::string> g_type_to_cpp_view_type{
+    {"byte",   "::umb::byte"},
+    {"int",    "int32_t"},
+    {"float",  "std::expected<float, ::umb::DecodeError>"},
+    {"bool",   "bool"},
+    {"bytes",  "std::span<const ::umb::byte>"},
+    {"string", "::umb::Ucs2View"},
+};
+
 static const std::unordered_map<std::string, std::string> g_cpp_default_value{
     {"byte",   "0"},
     {"int",    "0"},
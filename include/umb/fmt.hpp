@@ -22,10 +22,12 @@
 #include <charconv>
 #include <format>
 #include <limits>
+#include <memory_resource>
 #include <string>
 #include <vector>
 
 #include "umb/constants.hpp"
+#include "umb/inline_vector.hpp"
 
 namespace umb::fmt
 {
@@ -58,6 +60,28 @@ inline std::wstring to_wstring(const std::u16string& t)
     return {t.cbegin(), t.cend()};
 }
 
+inline std::wstring to_wstring(const std::pmr::vector<::umb::byte>& t)
+{
+    return to_wstring(std::vector<::umb::byte>{t.cbegin(), t.cend()});
+}
+
+inline std::wstring to_wstring(const std::pmr::u16string& t)
+{
+    return {t.cbegin(), t.cend()};
+}
+
+template<std::size_t N>
+inline std::wstring to_wstring(const ::umb::InlineBytes<N>& t)
+{
+    return to_wstring(std::vector<::umb::byte>{t.begin(), t.end()});
+}
+
+template<std::size_t N>
+inline std::wstring to_wstring(const ::umb::InlineString<N>& t)
+{
+    return {t.begin(), t.end()};
+}
+
 template<>
 inline std::wstring to_wstring(const float& t)
 {
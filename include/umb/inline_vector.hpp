@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_INLINE_VECTOR_HPP
+#define USCRIPT_MSGBUF_INLINE_VECTOR_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+#include "umb/constants.hpp"
+
+namespace umb
+{
+
+/**
+ * Fixed capacity inline storage for dynamic string and bytes fields.
+ * Generated messages use this instead of std::u16string and
+ * std::vector<byte> for fields with inline storage enabled, so
+ * setting and decoding these fields never allocates.
+ *
+ * @tparam T element type.
+ * @tparam N maximum number of elements.
+ */
+template<typename T, std::size_t N>
+    requires (N <= g_max_dynamic_size)
+class InlineVector
+{
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    constexpr InlineVector() noexcept = default;
+
+    constexpr explicit InlineVector(std::span<const T> values)
+    {
+        assign(values);
+    }
+
+    /**
+     * Replace the contents with \values, e.g. a std::u16string_view
+     * for strings or a std::vector for bytes.
+     * Throws std::invalid_argument if \values does not fit.
+     */
+    constexpr void assign(std::span<const T> values)
+    {
+        if (values.size() > capacity())
+        {
+            throw std::invalid_argument(
+                std::format("dynamic field too large: {}, capacity: {}", values.size(), capacity()));
+        }
+        m_size = static_cast<byte>(values.size());
+        std::copy_n(values.begin(), m_size, m_data.begin());
+    }
+
+    /**
+     * Set the size to \n without initializing new elements.
+     * \n must not exceed \capacity.
+     */
+    constexpr void resize_for_overwrite(std::size_t n) noexcept
+    {
+        m_size = static_cast<byte>(n);
+    }
+
+    constexpr void clear() noexcept
+    {
+        m_size = 0;
+    }
+
+    [[nodiscard]] constexpr T* data() noexcept
+    {
+        return m_data.data();
+    }
+
+    [[nodiscard]] constexpr const T* data() const noexcept
+    {
+        return m_data.data();
+    }
+
+    [[nodiscard]] constexpr std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    [[nodiscard]] constexpr bool empty() const noexcept
+    {
+        return m_size == 0;
+    }
+
+    [[nodiscard]] static constexpr std::size_t capacity() noexcept
+    {
+        return N;
+    }
+
+    [[nodiscard]] constexpr const T& operator[](std::size_t i) const noexcept
+    {
+        return m_data[i];
+    }
+
+    [[nodiscard]] constexpr iterator begin() noexcept
+    {
+        return data();
+    }
+
+    [[nodiscard]] constexpr iterator end() noexcept
+    {
+        return data() + m_size;
+    }
+
+    [[nodiscard]] constexpr const_iterator begin() const noexcept
+    {
+        return data();
+    }
+
+    [[nodiscard]] constexpr const_iterator end() const noexcept
+    {
+        return data() + m_size;
+    }
+
+    /**
+     * The stored elements as a std::u16string_view for strings
+     * and as a std::span for bytes.
+     */
+    [[nodiscard]] constexpr auto view() const noexcept
+    {
+        if constexpr (std::same_as<T, char16_t>)
+        {
+            return std::u16string_view{data(), size()};
+        }
+        else
+        {
+            return std::span<const T>{data(), size()};
+        }
+    }
+
+    [[nodiscard]] constexpr bool operator==(const InlineVector& other) const noexcept
+    {
+        return std::equal(begin(), end(), other.begin(), other.end());
+    }
+
+private:
+    std::array<T, N> m_data{};
+    byte m_size{0};
+};
+
+template<std::size_t N>
+using InlineString = InlineVector<char16_t, N>;
+
+template<std::size_t N>
+using InlineBytes = InlineVector<byte, N>;
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_INLINE_VECTOR_HPP
@@ -19,15 +19,87 @@
 
 #pragma once
 
+#include <cstddef>
 #include <span>
 #include <string>
 #include <vector>
 
 #include "umb/coding.hpp"
+#include "umb/packets.hpp"
 
 namespace umb
 {
 
+/**
+ * Serialized size of a generated message, kept up to date by field
+ * setters. Decoding marks the cache dirty, and the size is recomputed
+ * on the next Message::serialized_size call. A moved-from cache is also
+ * marked dirty, since the moved-from fields may have changed size.
+ */
+class SerializedSizeCache
+{
+public:
+    constexpr explicit SerializedSizeCache(std::size_t size) noexcept
+        : m_size(size)
+    {
+    }
+
+    constexpr SerializedSizeCache(const SerializedSizeCache&) noexcept = default;
+
+    constexpr SerializedSizeCache& operator=(const SerializedSizeCache&) noexcept = default;
+
+    constexpr SerializedSizeCache(SerializedSizeCache&& other) noexcept
+        : m_size(other.m_size), m_dirty(other.m_dirty)
+    {
+        other.m_dirty = true;
+    }
+
+    constexpr SerializedSizeCache& operator=(SerializedSizeCache&& other) noexcept
+    {
+        m_size = other.m_size;
+        m_dirty = other.m_dirty;
+        other.m_dirty = true;
+        return *this;
+    }
+
+    [[nodiscard]] constexpr bool dirty() const noexcept
+    {
+        return m_dirty;
+    }
+
+    [[nodiscard]] constexpr std::size_t get() const noexcept
+    {
+        return m_size;
+    }
+
+    constexpr void set(std::size_t size) noexcept
+    {
+        m_size = size;
+        m_dirty = false;
+    }
+
+    constexpr void invalidate() noexcept
+    {
+        m_dirty = true;
+    }
+
+    /**
+     * Account for a field changing its serialized size
+     * from \old_size to \new_size.
+     */
+    constexpr void adjust(std::size_t old_size, std::size_t new_size) noexcept
+    {
+        if (!m_dirty)
+        {
+            m_size = m_size - old_size + new_size;
+        }
+    }
+
+private:
+    std::size_t m_size;
+    bool m_dirty{false};
+};
+
 // TODO: constexpr virtual?
 
 class Message
@@ -35,14 +107,6 @@ class Message
 public:
     Message() = default;
 
-    Message(const Message&) = delete;
-
-    Message& operator=(const Message&) = delete;
-
-    Message(Message&&) noexcept = delete;
-
-    Message& operator=(Message&&) noexcept = delete;
-
     virtual ~Message() = default;
 
     /**
@@ -63,6 +127,32 @@ public:
      */
     [[nodiscard]] virtual bool to_bytes(std::span<byte> bytes) const = 0;
 
+    /**
+     * Serialize message to UMB wire format, appending the bytes
+     * to the end of \buffer. \buffer grows by Message::serialized_size()
+     * bytes. Existing capacity is reused, which allows encoding many
+     * messages into a single send buffer.
+     *
+     * @param buffer The buffer to append the wire format bytes to.
+     */
+    virtual void encode_append(std::vector<byte>& buffer) const = 0;
+
+    /**
+     * Serialize message to framed UMB packets, appending them to the
+     * end of \buffer. Messages larger than a single packet are split
+     * into multipart packets, each with its own header. The buffer can
+     * be written to the wire as is. See PacketFrames for a
+     * scatter-gather alternative that does not move the payload.
+     *
+     * @param buffer The buffer to append the packets to.
+     */
+    void to_packets(std::vector<byte>& buffer) const
+    {
+        const auto offset = buffer.size();
+        encode_append(buffer);
+        frame_packets_in_place(buffer, offset);
+    }
+
     /**
      * Initialize message from \bytes span containing valid
      * UMB wire format bytes for this message.
@@ -73,6 +163,30 @@ public:
      */
     virtual bool from_bytes(std::span<const byte> bytes) = 0;
 
+    /**
+     * Non-throwing version of Message::from_bytes that reports
+     * the reason for failure. On failure, the message fields are
+     * left in an unspecified but valid state.
+     *
+     * @param bytes UMB wire format bytes input span.
+     * @return empty result on success, otherwise the error code,
+     *         name and offset of the field that failed to decode.
+     */
+    virtual MessageDecodeResult try_from_bytes(std::span<const byte> bytes) = 0;
+
+    /**
+     * Initialize message from the packets of a multipart message,
+     * without reassembling them into a single buffer first. Fields
+     * are decoded in place, only a field split across two packets
+     * is copied. Error offsets are relative to the reassembled message.
+     *
+     * @param parts all packets of the message in order, each
+     *  including its header. A single part message is also accepted.
+     * @return empty result on success, otherwise the error code,
+     *         name and offset of the field that failed to decode.
+     */
+    virtual MessageDecodeResult try_from_parts(std::span<const std::span<const byte>> parts) = 0;
+
     /**
      * Return calculated UMB wire format size of this message
      * in bytes. The size may change if message fields are
@@ -92,10 +206,26 @@ public:
      */
     [[nodiscard]] virtual std::wstring to_string() const = 0;
 
+    /**
+     * Restore all fields to their default values. Storage
+     * already allocated by dynamic fields is kept for reuse.
+     */
+    virtual void reset() noexcept = 0;
+
     // TODO: reconsider this API. Don't use uint16_t directly?
     [[nodiscard]] constexpr virtual uint16_t type() const noexcept = 0;
 
 protected:
+    // Generated messages are copyable and movable. Protected
+    // to prevent slicing through base class references.
+    Message(const Message&) = default;
+
+    Message& operator=(const Message&) = default;
+
+    Message(Message&&) noexcept = default;
+
+    Message& operator=(Message&&) noexcept = default;
+
     [[nodiscard]] virtual bool is_equal(const Message& msg) const = 0;
 
     friend inline bool operator==(const Message&, const Message&);
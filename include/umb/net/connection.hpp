@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_NET_CONNECTION_HPP
+#define USCRIPT_MSGBUF_NET_CONNECTION_HPP
+
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+
+#include "umb/constants.hpp"
+#include "umb/outgoing_queue.hpp"
+#include "umb/stream_parser.hpp"
+
+namespace umb::net
+{
+
+// Default size of the per-connection receive buffer.
+constexpr std::size_t g_default_recv_buffer_size = 64 * 1024;
+
+/**
+ * Handles the messages of one connection, invoked as
+ * handler(message, queue) for every received message.
+ * Replies are pushed to the connection's outgoing queue.
+ * All transport backends take the same handler.
+ */
+template<typename H>
+concept MessageHandler = std::invocable<H&, const StreamMessage&, OutgoingQueue&>
+                         && std::is_void_v<std::invoke_result_t<H&, const StreamMessage&, OutgoingQueue&>>;
+
+/**
+ * Coroutine MessageHandler, such as a Router<boost::asio::awaitable<void>>.
+ * The next message is handled once the previous handler completes.
+ * Only supported by the Asio backend.
+ */
+template<typename H>
+concept AsyncMessageHandler = std::invocable<H&, const StreamMessage&, OutgoingQueue&>
+                              && std::same_as<std::invoke_result_t<H&, const StreamMessage&, OutgoingQueue&>,
+                                              boost::asio::awaitable<void>>;
+
+/**
+ * Why serve_messages() returned.
+ */
+struct CloseReason
+{
+    // Read or write error, boost::asio::error::eof if the peer closed the connection.
+    boost::system::error_code error{};
+    // Set if the peer sent a malformed stream.
+    std::optional<StreamError> stream_error{};
+};
+
+namespace internal
+{
+
+template<typename Handler>
+struct AsioConnection
+{
+    AsioConnection(boost::asio::ip::tcp::socket s, Handler h, FlushPolicy policy)
+        : socket(std::move(s)),
+          handler(std::move(h)),
+          queue(policy),
+          wakeup(socket.get_executor())
+    {
+    }
+
+    void close()
+    {
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        wakeup.cancel();
+    }
+
+    // Wake up write_loop if a flush is due, or if the queued
+    // packets are due before write_loop is going to wake up.
+    void notify_writer()
+    {
+        if (queue.flush_due() || queue.deadline() < wakeup.expiry())
+        {
+            wakeup.cancel();
+        }
+    }
+
+    // No more messages, write_loop sends what is queued and closes.
+    void finish_reading()
+    {
+        reading = false;
+        wakeup.cancel();
+    }
+
+    boost::asio::ip::tcp::socket socket;
+    Handler handler;
+    OutgoingQueue queue;
+    boost::asio::steady_timer wakeup;
+    CloseReason reason{};
+    bool reading{true};
+};
+
+template<typename Handler>
+boost::asio::awaitable<void> read_loop(AsioConnection<Handler>& conn, std::size_t recv_buffer_size)
+{
+    std::vector<byte> recv_buf(recv_buffer_size);
+    // Tracks partial packets and multipart messages across reads.
+    StreamParser parser;
+
+    for (;;)
+    {
+        const auto [ec, num_read] = co_await conn.socket.async_read_some(
+            boost::asio::buffer(recv_buf), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (ec)
+        {
+            // Keep the write error if the writer closed the socket.
+            if (!conn.reason.error)
+            {
+                conn.reason.error = ec;
+            }
+            break;
+        }
+
+        // Handle every complete message in the buffer before reading again.
+        parser.feed(std::span{recv_buf}.first(num_read));
+        for (;;)
+        {
+            const auto result = parser.next();
+            if (!result.has_value())
+            {
+                conn.reason.stream_error = result.error();
+                conn.finish_reading();
+                co_return;
+            }
+            if (!result->has_value())
+            {
+                break;
+            }
+            if constexpr (AsyncMessageHandler<Handler>)
+            {
+                co_await conn.handler(**result, conn.queue);
+            }
+            else
+            {
+                conn.handler(**result, conn.queue);
+            }
+            conn.notify_writer();
+            if (conn.queue.flush_due())
+            {
+                // Let write_loop start the write before the next message.
+                co_await boost::asio::post(conn.socket.get_executor(), boost::asio::use_awaitable);
+            }
+        }
+
+        conn.queue.end_batch();
+        conn.notify_writer();
+    }
+
+    conn.finish_reading();
+}
+
+// Write queued packets with one write per flush. Once reading has
+// finished, the rest of the queue is written before closing the socket.
+template<typename Handler>
+boost::asio::awaitable<void> write_loop(AsioConnection<Handler>& conn)
+{
+    for (;;)
+    {
+        const bool draining = !conn.reading && conn.queue.pending_bytes() > 0;
+        if (!conn.queue.flush_due() && !draining)
+        {
+            if (!conn.reading)
+            {
+                break;
+            }
+            conn.wakeup.expires_at(conn.queue.deadline());
+            co_await conn.wakeup.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+            continue;
+        }
+
+        const auto bytes = conn.queue.begin_flush();
+        const auto [ec, num_sent] = co_await boost::asio::async_write(
+            conn.socket,
+            boost::asio::buffer(bytes.data(), bytes.size()),
+            boost::asio::as_tuple(boost::asio::use_awaitable));
+        conn.queue.end_flush();
+
+        if (ec)
+        {
+            if (!conn.reason.error && !conn.reason.stream_error)
+            {
+                conn.reason.error = ec;
+            }
+            conn.close();
+            co_return;
+        }
+    }
+
+    conn.close();
+}
+
+} // namespace internal
+
+/**
+ * Serve \socket with the Asio backend until either side closes it.
+ * Reads are parsed with a StreamParser and every complete message
+ * is passed to \handler, which is either a MessageHandler or an
+ * AsyncMessageHandler. Replies queued by the handler are written
+ * according to \policy, while the next read is already in progress.
+ * When the peer closes the connection or sends a malformed stream,
+ * queued replies are still written before the socket is closed.
+ *
+ * Meant to be returned from a umb::net::Server connection handler.
+ */
+template<typename Handler>
+requires MessageHandler<Handler> || AsyncMessageHandler<Handler>
+boost::asio::awaitable<CloseReason> serve_messages(
+    boost::asio::ip::tcp::socket socket,
+    Handler handler,
+    FlushPolicy policy = {},
+    std::size_t recv_buffer_size = g_default_recv_buffer_size)
+{
+    using namespace boost::asio::experimental::awaitable_operators;
+
+    internal::AsioConnection<Handler> conn{std::move(socket), std::move(handler), policy};
+    co_await (internal::read_loop(conn, recv_buffer_size) && internal::write_loop(conn));
+    co_return conn.reason;
+}
+
+} // namespace umb::net
+
+#endif // USCRIPT_MSGBUF_NET_CONNECTION_HPP
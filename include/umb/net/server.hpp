@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_NET_SERVER_HPP
+#define USCRIPT_MSGBUF_NET_SERVER_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+// SO_REUSEPORT load balances connections between acceptors on Linux
+// (since 3.9). On other platforms it does not balance, or does not exist.
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#define UMB_NET_HAS_REUSEPORT 1
+#else
+#define UMB_NET_HAS_REUSEPORT 0
+#endif
+
+namespace umb::net
+{
+
+// Wait before accepting again after an accept error, such as running
+// out of file descriptors or memory, so other connections get a chance
+// to close instead of the acceptor retrying in a busy loop.
+constexpr std::chrono::milliseconds g_accept_retry_delay{100};
+
+/**
+ * How accepted connections are distributed to worker threads.
+ */
+enum class AcceptMode
+{
+    // Every worker has its own SO_REUSEPORT acceptor on the
+    // same endpoint, the kernel picks the worker.
+    reuse_port,
+    // A single acceptor on the first worker hands connections
+    // to the workers in round-robin order.
+    round_robin,
+};
+
+struct ServerOptions
+{
+    // With port 0, the port picked for the first acceptor is used for all of them.
+    boost::asio::ip::tcp::endpoint endpoint{boost::asio::ip::tcp::v4(), 55555};
+    // Number of worker threads, 0 uses one per hardware thread.
+    std::size_t num_threads{0};
+    AcceptMode accept_mode{UMB_NET_HAS_REUSEPORT ? AcceptMode::reuse_port : AcceptMode::round_robin};
+};
+
+namespace internal
+{
+
+// ServerOptions::num_threads with 0 resolved to the hardware thread count.
+[[nodiscard]] inline std::size_t resolve_num_threads(std::size_t num_threads) noexcept
+{
+    if (num_threads == 0)
+    {
+        return std::max(1U, std::thread::hardware_concurrency());
+    }
+    return num_threads;
+}
+
+} // namespace internal
+
+/**
+ * Multithreaded TCP server. Runs one io_context per worker thread,
+ * and every connection stays on the worker it was assigned to for its
+ * whole lifetime. Connection state is only touched by one thread and
+ * per-thread state, such as thread_message_pool(), can be used
+ * without locking.
+ *
+ * @tparam Handler invoked as handler(socket) on the connection's
+ *  worker thread, returns an awaitable<void> that serves the
+ *  connection. Called concurrently from all workers.
+ */
+template<typename Handler>
+requires std::invocable<const Handler&, boost::asio::ip::tcp::socket>
+class Server
+{
+public:
+    using tcp = boost::asio::ip::tcp;
+
+    Server(ServerOptions options, Handler handler)
+        : m_options(std::move(options)),
+          m_handler(std::move(handler))
+    {
+        m_options.num_threads = internal::resolve_num_threads(m_options.num_threads);
+#if !UMB_NET_HAS_REUSEPORT
+        if (m_options.accept_mode == AcceptMode::reuse_port)
+        {
+            throw std::invalid_argument("AcceptMode::reuse_port is not supported on this platform");
+        }
+#endif
+
+        m_workers.reserve(m_options.num_threads);
+        for (std::size_t i = 0; i < m_options.num_threads; ++i)
+        {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+    }
+
+    Server(const Server&) = delete;
+
+    Server& operator=(const Server&) = delete;
+
+    ~Server()
+    {
+        stop();
+    }
+
+    /**
+     * Open the acceptors and start the worker threads.
+     * Throws boost::system::system_error if binding fails.
+     */
+    void start()
+    {
+        open_acceptors();
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+        {
+            auto& worker = *m_workers[i];
+            if (worker.acceptor)
+            {
+                boost::asio::co_spawn(worker.io, accept_loop(i), boost::asio::detached);
+            }
+            worker.thread = std::jthread([this, &worker]
+                                         {
+                                             // A failing worker stops its own thread only.
+                                             try
+                                             {
+                                                 worker.io.run();
+                                             }
+                                             catch (...)
+                                             {
+                                                 std::scoped_lock lock{m_error_mutex};
+                                                 if (!m_error)
+                                                 {
+                                                     m_error = std::current_exception();
+                                                 }
+                                             }
+                                         });
+        }
+    }
+
+    /**
+     * Stop all workers and wait for their threads to exit.
+     * Open connections are abandoned.
+     */
+    void stop()
+    {
+        for (auto& worker: m_workers)
+        {
+            worker->io.stop();
+        }
+        for (auto& worker: m_workers)
+        {
+            if (worker->thread.joinable())
+            {
+                worker->thread.join();
+            }
+        }
+    }
+
+    /**
+     * Endpoint the server is listening on. Useful when binding to port 0.
+     */
+    [[nodiscard]] tcp::endpoint local_endpoint() const
+    {
+        return m_workers.front()->acceptor->local_endpoint();
+    }
+
+    [[nodiscard]] std::size_t num_threads() const noexcept
+    {
+        return m_workers.size();
+    }
+
+    /**
+     * First exception that escaped a worker's io_context, such as one
+     * thrown by the handler, or null if all workers are running.
+     */
+    [[nodiscard]] std::exception_ptr error() const
+    {
+        std::scoped_lock lock{m_error_mutex};
+        return m_error;
+    }
+
+private:
+    struct Worker
+    {
+        boost::asio::io_context io{1};
+        // Keeps workers without an acceptor running.
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work{io.get_executor()};
+        std::unique_ptr<tcp::acceptor> acceptor;
+        std::jthread thread;
+    };
+
+    void open_acceptors()
+    {
+        auto endpoint = m_options.endpoint;
+        const auto num_acceptors = m_options.accept_mode == AcceptMode::reuse_port ? m_workers.size() : 1;
+        for (std::size_t i = 0; i < num_acceptors; ++i)
+        {
+            auto& worker = *m_workers[i];
+            worker.acceptor = std::make_unique<tcp::acceptor>(worker.io);
+            worker.acceptor->open(endpoint.protocol());
+            worker.acceptor->set_option(tcp::acceptor::reuse_address(true));
+#if UMB_NET_HAS_REUSEPORT
+            if (m_options.accept_mode == AcceptMode::reuse_port)
+            {
+                using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+                worker.acceptor->set_option(reuse_port(true));
+            }
+#endif
+            worker.acceptor->bind(endpoint);
+            worker.acceptor->listen();
+            endpoint = worker.acceptor->local_endpoint();
+        }
+    }
+
+    boost::asio::awaitable<void> accept_loop(std::size_t worker_index)
+    {
+        auto& acceptor = *m_workers[worker_index]->acceptor;
+        const Handler& handler = m_handler;
+        boost::asio::steady_timer retry_timer{acceptor.get_executor()};
+        std::size_t next = 0;
+        while (acceptor.is_open())
+        {
+            // With round-robin handoff the socket is created on the
+            // target worker's io_context and never touched here again.
+            auto& target = m_options.accept_mode == AcceptMode::reuse_port
+                           ? *m_workers[worker_index]
+                           : *m_workers[next++ % m_workers.size()];
+            auto [ec, socket] = co_await acceptor.async_accept(
+                target.io, boost::asio::as_tuple(boost::asio::use_awaitable));
+            if (ec == boost::asio::error::operation_aborted)
+            {
+                co_return;
+            }
+            if (ec == boost::asio::error::connection_aborted)
+            {
+                continue;
+            }
+            if (ec)
+            {
+                retry_timer.expires_after(g_accept_retry_delay);
+                co_await retry_timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+                continue;
+            }
+            // The handler is invoked on the target worker, not the accepting one.
+            boost::asio::post(target.io, [&handler, &io = target.io, socket = std::move(socket)]() mutable
+            {
+                boost::asio::co_spawn(io, handler(std::move(socket)), boost::asio::detached);
+            });
+        }
+    }
+
+    ServerOptions m_options;
+    Handler m_handler;
+    mutable std::mutex m_error_mutex;
+    std::exception_ptr m_error;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+};
+
+} // namespace umb::net
+
+#endif // USCRIPT_MSGBUF_NET_SERVER_HPP
@@ -0,0 +1,767 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_NET_URING_SERVER_HPP
+#define USCRIPT_MSGBUF_NET_URING_SERVER_HPP
+
+#pragma once
+
+// Defined by the build when the io_uring backend is enabled,
+// see UMB_WITH_IO_URING in CMakeLists.txt.
+#ifndef UMB_NET_HAS_IO_URING
+#define UMB_NET_HAS_IO_URING 0
+#endif
+
+#if UMB_NET_HAS_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <liburing.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include "umb/constants.hpp"
+#include "umb/net/connection.hpp"
+#include "umb/net/server.hpp"
+#include "umb/outgoing_queue.hpp"
+#include "umb/stream_parser.hpp"
+
+namespace umb::net
+{
+
+struct UringServerOptions
+{
+    // Every worker has its own listener, only AcceptMode::reuse_port is supported.
+    ServerOptions server{};
+    FlushPolicy flush_policy{};
+    // Submission queue size of each worker's ring.
+    unsigned ring_entries{1024};
+    // Receive buffers of each worker, shared by all of its
+    // connections. Must be a power of two.
+    unsigned num_buffers{256};
+    unsigned buffer_size{16 * 1024};
+};
+
+namespace internal
+{
+
+[[noreturn]] inline void throw_errno(int error, const char* what)
+{
+    throw std::system_error(error, std::system_category(), what);
+}
+
+class UniqueFd
+{
+public:
+    UniqueFd() = default;
+
+    explicit UniqueFd(int fd) noexcept
+        : m_fd(fd)
+    {
+    }
+
+    UniqueFd(UniqueFd&& other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1))
+    {
+    }
+
+    UniqueFd& operator=(UniqueFd&& other) noexcept
+    {
+        std::swap(m_fd, other.m_fd);
+        return *this;
+    }
+
+    ~UniqueFd()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+    }
+
+    [[nodiscard]] int get() const noexcept
+    {
+        return m_fd;
+    }
+
+private:
+    int m_fd{-1};
+};
+
+inline UniqueFd open_reuse_port_listener(const boost::asio::ip::tcp::endpoint& endpoint)
+{
+    UniqueFd fd{::socket(endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (fd.get() < 0)
+    {
+        throw_errno(errno, "socket");
+    }
+    const int one = 1;
+    if (::setsockopt(fd.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+        || ::setsockopt(fd.get(), SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+    {
+        throw_errno(errno, "setsockopt");
+    }
+    if (::bind(fd.get(), endpoint.data(), static_cast<socklen_t>(endpoint.size())) < 0)
+    {
+        throw_errno(errno, "bind");
+    }
+    if (::listen(fd.get(), SOMAXCONN) < 0)
+    {
+        throw_errno(errno, "listen");
+    }
+    return fd;
+}
+
+/**
+ * One io_uring event loop with its own listening socket,
+ * receive buffer ring and connections.
+ */
+template<MessageHandler Handler>
+class UringWorker
+{
+public:
+    UringWorker(const UringServerOptions& options, const Handler& handler, UniqueFd listener)
+        : m_options(options),
+          m_handler(handler),
+          m_listener(std::move(listener)),
+          m_buffers(std::make_unique<byte[]>(std::size_t{options.num_buffers} * options.buffer_size))
+    {
+        if (const int ret = io_uring_queue_init(options.ring_entries, &m_ring, 0); ret < 0)
+        {
+            throw_errno(-ret, "io_uring_queue_init");
+        }
+
+        // Registered with the kernel, which picks a free buffer for every
+        // completed receive. Buffers go back to the ring once parsed.
+        int ret = 0;
+        m_buf_ring = io_uring_setup_buf_ring(&m_ring, options.num_buffers, g_buffer_group, 0, &ret);
+        if (m_buf_ring == nullptr)
+        {
+            io_uring_queue_exit(&m_ring);
+            throw_errno(-ret, "io_uring_setup_buf_ring");
+        }
+        const auto mask = io_uring_buf_ring_mask(options.num_buffers);
+        for (unsigned i = 0; i < options.num_buffers; ++i)
+        {
+            io_uring_buf_ring_add(m_buf_ring, buffer(i), options.buffer_size,
+                                  static_cast<unsigned short>(i), mask, static_cast<int>(i));
+        }
+        io_uring_buf_ring_advance(m_buf_ring, static_cast<int>(options.num_buffers));
+    }
+
+    UringWorker(const UringWorker&) = delete;
+
+    UringWorker& operator=(const UringWorker&) = delete;
+
+    ~UringWorker()
+    {
+        io_uring_free_buf_ring(&m_ring, m_buf_ring, m_options.num_buffers, g_buffer_group);
+        io_uring_queue_exit(&m_ring);
+    }
+
+    [[nodiscard]] int listener() const noexcept
+    {
+        return m_listener.get();
+    }
+
+    void run(const std::stop_token& stop)
+    {
+        arm_accept();
+        while (!stop.stop_requested())
+        {
+            if (m_accept_retry_at && clock::now() >= *m_accept_retry_at)
+            {
+                m_accept_retry_at.reset();
+                arm_accept();
+            }
+
+            auto timeout = to_timespec(wait_time());
+            io_uring_cqe* cqe = nullptr;
+            const int ret = io_uring_submit_and_wait_timeout(&m_ring, &cqe, 1, &timeout, nullptr);
+            if (ret < 0 && ret != -ETIME && ret != -EINTR)
+            {
+                throw_errno(-ret, "io_uring_submit_and_wait_timeout");
+            }
+
+            unsigned head = 0;
+            unsigned count = 0;
+            io_uring_for_each_cqe(&m_ring, head, cqe)
+            {
+                handle(*cqe);
+                ++count;
+            }
+            io_uring_cq_advance(&m_ring, count);
+
+            flush(OutgoingQueue::clock::now());
+            release_closed();
+        }
+    }
+
+private:
+    using clock = OutgoingQueue::clock;
+
+    static constexpr int g_buffer_group = 0;
+
+    // Stored in the low bits of the completion user data.
+    enum class Op : std::uintptr_t
+    {
+        accept = 0,
+        recv = 1,
+        send = 2,
+    };
+
+    static constexpr std::uintptr_t g_op_mask = 0b11;
+
+    struct Connection
+    {
+        Connection(UniqueFd f, const Handler& h, FlushPolicy policy)
+            : fd(std::move(f)),
+              handler(h),
+              queue(policy)
+        {
+        }
+
+        UniqueFd fd;
+        Handler handler;
+        StreamParser parser;
+        OutgoingQueue queue;
+        // Part of the in-flight flush not yet sent.
+        std::span<const byte> sending{};
+        std::size_t index{0};
+        int ops_in_flight{0};
+        bool recv_armed{false};
+        bool touched{false};
+        // Position in the worker's threshold deadline list.
+        Connection* timer_prev{nullptr};
+        Connection* timer_next{nullptr};
+        clock::time_point timer_deadline{};
+        bool timer_linked{false};
+        // No more messages, close once the queue is sent.
+        bool reading_done{false};
+        bool closing{false};
+        bool released{false};
+    };
+
+    static_assert(alignof(Connection) > g_op_mask);
+
+    [[nodiscard]] byte* buffer(unsigned id) const noexcept
+    {
+        return m_buffers.get() + std::size_t{id} * m_options.buffer_size;
+    }
+
+    [[nodiscard]] static std::uint64_t user_data(Connection* conn, Op op) noexcept
+    {
+        return reinterpret_cast<std::uintptr_t>(conn) | static_cast<std::uintptr_t>(op);
+    }
+
+    [[nodiscard]] io_uring_sqe* get_sqe()
+    {
+        auto* sqe = io_uring_get_sqe(&m_ring);
+        if (sqe == nullptr)
+        {
+            // Submission queue full, make room.
+            io_uring_submit(&m_ring);
+            sqe = io_uring_get_sqe(&m_ring);
+            if (sqe == nullptr)
+            {
+                throw_errno(EBUSY, "io_uring_get_sqe");
+            }
+        }
+        return sqe;
+    }
+
+    // Wake up for the next threshold deadline or accept retry,
+    // or at least often enough to notice a stop request.
+    [[nodiscard]] clock::duration wait_time() const
+    {
+        clock::duration wait = std::chrono::milliseconds{100};
+        const auto now = clock::now();
+        if (m_timers_head)
+        {
+            wait = std::min(wait, std::max(clock::duration{0}, m_timers_head->timer_deadline - now));
+        }
+        if (m_accept_retry_at)
+        {
+            wait = std::min(wait, std::max(clock::duration{0}, *m_accept_retry_at - now));
+        }
+        return wait;
+    }
+
+    [[nodiscard]] static __kernel_timespec to_timespec(clock::duration d) noexcept
+    {
+        const auto sec = std::chrono::duration_cast<std::chrono::seconds>(d);
+        const auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(d - sec);
+        return {.tv_sec = sec.count(), .tv_nsec = nsec.count()};
+    }
+
+    void arm_accept()
+    {
+        auto* sqe = get_sqe();
+        io_uring_prep_multishot_accept(sqe, m_listener.get(), nullptr, nullptr, SOCK_CLOEXEC);
+        io_uring_sqe_set_data64(sqe, user_data(nullptr, Op::accept));
+    }
+
+    void arm_recv(Connection& conn)
+    {
+        auto* sqe = get_sqe();
+        io_uring_prep_recv_multishot(sqe, conn.fd.get(), nullptr, 0, 0);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = g_buffer_group;
+        io_uring_sqe_set_data64(sqe, user_data(&conn, Op::recv));
+        conn.recv_armed = true;
+        ++conn.ops_in_flight;
+    }
+
+    void submit_send(Connection& conn)
+    {
+        auto* sqe = get_sqe();
+        io_uring_prep_send(sqe, conn.fd.get(), conn.sending.data(), conn.sending.size(), MSG_NOSIGNAL);
+        io_uring_sqe_set_data64(sqe, user_data(&conn, Op::send));
+        ++conn.ops_in_flight;
+    }
+
+    void handle(const io_uring_cqe& cqe)
+    {
+        const auto data = static_cast<std::uintptr_t>(io_uring_cqe_get_data64(&cqe));
+        auto* conn = reinterpret_cast<Connection*>(data & ~g_op_mask);
+        switch (static_cast<Op>(data & g_op_mask))
+        {
+            case Op::accept:
+                on_accept(cqe.res, cqe.flags);
+                break;
+            case Op::recv:
+                on_recv(*conn, cqe.res, cqe.flags);
+                break;
+            case Op::send:
+                on_send(*conn, cqe.res);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void on_accept(int res, unsigned flags)
+    {
+        if (res >= 0)
+        {
+            auto conn = std::make_unique<Connection>(UniqueFd{res}, m_handler, m_options.flush_policy);
+            conn->index = m_connections.size();
+            arm_recv(*conn);
+            m_connections.push_back(std::move(conn));
+        }
+        if ((flags & IORING_CQE_F_MORE) != 0)
+        {
+            return;
+        }
+        if (res >= 0 || res == -ECONNABORTED)
+        {
+            arm_accept();
+        }
+        else
+        {
+            m_accept_retry_at = clock::now() + g_accept_retry_delay;
+        }
+    }
+
+    void on_recv(Connection& conn, int res, unsigned flags)
+    {
+        if ((flags & IORING_CQE_F_MORE) == 0)
+        {
+            conn.recv_armed = false;
+            --conn.ops_in_flight;
+        }
+
+        if (res > 0)
+        {
+            const auto id = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (!conn.closing && !conn.reading_done)
+            {
+                consume(conn, {buffer(id), static_cast<std::size_t>(res)});
+            }
+            // The parser copies what it keeps, the buffer can be reused.
+            io_uring_buf_ring_add(m_buf_ring, buffer(id), m_options.buffer_size, static_cast<unsigned short>(id),
+                                  io_uring_buf_ring_mask(m_options.num_buffers), 0);
+            io_uring_buf_ring_advance(m_buf_ring, 1);
+        }
+        else if (res == 0)
+        {
+            finish_reading(conn);
+        }
+        else if (res != -ENOBUFS)
+        {
+            close(conn);
+        }
+
+        if (!conn.recv_armed && !conn.closing && !conn.reading_done)
+        {
+            arm_recv(conn);
+        }
+        release_if_done(conn);
+    }
+
+    void on_send(Connection& conn, int res)
+    {
+        --conn.ops_in_flight;
+        if (res < 0)
+        {
+            close(conn);
+        }
+        else
+        {
+            conn.sending = conn.sending.subspan(static_cast<std::size_t>(res));
+        }
+
+        if (!conn.sending.empty() && !conn.closing)
+        {
+            // Short write, send the rest.
+            submit_send(conn);
+        }
+        else
+        {
+            conn.sending = {};
+            conn.queue.end_flush();
+            // Messages may have been queued during the write.
+            touch(conn);
+        }
+        release_if_done(conn);
+    }
+
+    // Handle every complete message received in \data.
+    void consume(Connection& conn, std::span<const byte> data)
+    {
+        const auto now = clock::now();
+        conn.parser.feed(data);
+        for (;;)
+        {
+            const auto result = conn.parser.next();
+            if (!result.has_value())
+            {
+                finish_reading(conn);
+                return;
+            }
+            if (!result->has_value())
+            {
+                break;
+            }
+            conn.handler(**result, conn.queue);
+            // Immediate mode sends the first reply right away, the
+            // rest are sent together once that send completes.
+            try_send(conn, now);
+        }
+        conn.queue.end_batch();
+        touch(conn);
+    }
+
+    void touch(Connection& conn)
+    {
+        if (!conn.touched)
+        {
+            conn.touched = true;
+            m_touched.push_back(&conn);
+        }
+    }
+
+    // Stop handling messages of \conn and close it once its queue is sent.
+    void finish_reading(Connection& conn)
+    {
+        conn.reading_done = true;
+        touch(conn);
+    }
+
+    // Start a write if a flush is due and no write is in flight.
+    // Once reading is done, everything queued is due.
+    void try_send(Connection& conn, clock::time_point now)
+    {
+        if (!conn.closing && conn.sending.empty()
+            && (conn.queue.flush_due(now) || (conn.reading_done && conn.queue.pending_bytes() > 0)))
+        {
+            conn.sending = conn.queue.begin_flush();
+            submit_send(conn);
+        }
+    }
+
+    // Start a write on every connection with a flush due.
+    void flush(clock::time_point now)
+    {
+        for (auto* conn: m_touched)
+        {
+            conn->touched = false;
+            try_send(*conn, now);
+            if (conn->reading_done && conn->sending.empty())
+            {
+                close(*conn);
+            }
+            update_timer(*conn);
+        }
+        m_touched.clear();
+
+        // Idle connections past their deadline.
+        while (m_timers_head && m_timers_head->timer_deadline <= now)
+        {
+            auto& conn = *m_timers_head;
+            unlink_timer(conn);
+            try_send(conn, now);
+        }
+    }
+
+    // Keep \conn in the deadline list while its queued messages wait
+    // for a threshold deadline. With a send in flight, the queue is
+    // flushed when the send completes instead.
+    void update_timer(Connection& conn)
+    {
+        const auto deadline = conn.queue.deadline();
+        const bool waiting = !conn.closing && conn.sending.empty() && deadline != clock::time_point::max();
+        if (conn.timer_linked && (!waiting || conn.timer_deadline != deadline))
+        {
+            unlink_timer(conn);
+        }
+        if (waiting && !conn.timer_linked)
+        {
+            link_timer(conn, deadline);
+        }
+    }
+
+    // Deadlines are added in nearly increasing order, so the
+    // insertion point is found from the back.
+    void link_timer(Connection& conn, clock::time_point deadline)
+    {
+        auto* prev = m_timers_tail;
+        while (prev && prev->timer_deadline > deadline)
+        {
+            prev = prev->timer_prev;
+        }
+        auto* next = prev ? prev->timer_next : m_timers_head;
+
+        conn.timer_deadline = deadline;
+        conn.timer_prev = prev;
+        conn.timer_next = next;
+        conn.timer_linked = true;
+        (prev ? prev->timer_next : m_timers_head) = &conn;
+        (next ? next->timer_prev : m_timers_tail) = &conn;
+    }
+
+    void unlink_timer(Connection& conn)
+    {
+        (conn.timer_prev ? conn.timer_prev->timer_next : m_timers_head) = conn.timer_next;
+        (conn.timer_next ? conn.timer_next->timer_prev : m_timers_tail) = conn.timer_prev;
+        conn.timer_prev = nullptr;
+        conn.timer_next = nullptr;
+        conn.timer_linked = false;
+    }
+
+    void close(Connection& conn)
+    {
+        if (conn.closing)
+        {
+            return;
+        }
+        conn.closing = true;
+        if (conn.timer_linked)
+        {
+            unlink_timer(conn);
+        }
+        // Ends the multishot receive, fails an in-flight send.
+        ::shutdown(conn.fd.get(), SHUT_RDWR);
+        release_if_done(conn);
+    }
+
+    void release_if_done(Connection& conn)
+    {
+        if (conn.closing && conn.ops_in_flight == 0 && !conn.released)
+        {
+            conn.released = true;
+            m_closed.push_back(&conn);
+        }
+    }
+
+    // Destroy closed connections once no operation refers to them.
+    void release_closed()
+    {
+        for (auto* conn: m_closed)
+        {
+            const auto index = conn->index;
+            std::swap(m_connections[index], m_connections.back());
+            m_connections[index]->index = index;
+            m_connections.pop_back();
+        }
+        m_closed.clear();
+    }
+
+    const UringServerOptions& m_options;
+    const Handler& m_handler;
+    UniqueFd m_listener;
+    io_uring m_ring{};
+    io_uring_buf_ring* m_buf_ring{nullptr};
+    std::unique_ptr<byte[]> m_buffers;
+    std::vector<std::unique_ptr<Connection>> m_connections;
+    std::vector<Connection*> m_touched;
+    std::vector<Connection*> m_closed;
+    // Connections waiting for a threshold deadline, earliest first.
+    Connection* m_timers_head{nullptr};
+    Connection* m_timers_tail{nullptr};
+    std::optional<clock::time_point> m_accept_retry_at;
+};
+
+} // namespace internal
+
+/**
+ * Linux io_uring server backend. Every worker thread runs its own ring
+ * with a SO_REUSEPORT listener, a multishot accept and a multishot
+ * receive per connection. Received data lands in a buffer ring
+ * registered with the kernel and is parsed in place, so there is no
+ * read syscall or copy per packet. Replies are coalesced in each
+ * connection's OutgoingQueue and sent with one send per flush.
+ *
+ * Takes the same MessageHandler as serve_messages(). The handler is
+ * copied for every connection and only called on its worker thread.
+ * Requires Linux 6.0 and liburing 2.4.
+ */
+template<MessageHandler Handler>
+class UringServer
+{
+public:
+    using tcp = boost::asio::ip::tcp;
+
+    UringServer(UringServerOptions options, Handler handler)
+        : m_options(std::move(options)),
+          m_handler(std::move(handler))
+    {
+        m_options.server.num_threads = internal::resolve_num_threads(m_options.server.num_threads);
+        if (m_options.server.accept_mode != AcceptMode::reuse_port)
+        {
+            throw std::invalid_argument("UringServer only supports AcceptMode::reuse_port");
+        }
+    }
+
+    UringServer(const UringServer&) = delete;
+
+    UringServer& operator=(const UringServer&) = delete;
+
+    ~UringServer()
+    {
+        stop();
+    }
+
+    /**
+     * Open the listeners and start the worker threads.
+     * Throws std::system_error if setup fails.
+     */
+    void start()
+    {
+        auto endpoint = m_options.server.endpoint;
+        for (std::size_t i = 0; i < m_options.server.num_threads; ++i)
+        {
+            m_workers.push_back(std::make_unique<internal::UringWorker<Handler>>(
+                m_options, m_handler, internal::open_reuse_port_listener(endpoint)));
+            endpoint = local_endpoint();
+        }
+        for (auto& worker: m_workers)
+        {
+            m_threads.emplace_back([this, &worker](const std::stop_token& stop)
+                                   {
+                                       // A failing ring stops its own worker only.
+                                       try
+                                       {
+                                           worker->run(stop);
+                                       }
+                                       catch (...)
+                                       {
+                                           std::scoped_lock lock{m_error_mutex};
+                                           if (!m_error)
+                                           {
+                                               m_error = std::current_exception();
+                                           }
+                                       }
+                                   });
+        }
+    }
+
+    /**
+     * Stop all workers and wait for their threads to exit.
+     * Open connections are closed.
+     */
+    void stop()
+    {
+        for (auto& thread: m_threads)
+        {
+            thread.request_stop();
+        }
+        m_threads.clear();
+        m_workers.clear();
+    }
+
+    /**
+     * Endpoint the server is listening on. Useful when binding to port 0.
+     */
+    [[nodiscard]] tcp::endpoint local_endpoint() const
+    {
+        tcp::endpoint endpoint;
+        auto size = static_cast<socklen_t>(endpoint.capacity());
+        if (::getsockname(m_workers.front()->listener(), endpoint.data(), &size) < 0)
+        {
+            internal::throw_errno(errno, "getsockname");
+        }
+        endpoint.resize(size);
+        return endpoint;
+    }
+
+    [[nodiscard]] std::size_t num_threads() const noexcept
+    {
+        return m_options.server.num_threads;
+    }
+
+    /**
+     * First error that stopped a worker thread, or null if all
+     * workers are running. Connections of a stopped worker are
+     * closed by stop().
+     */
+    [[nodiscard]] std::exception_ptr error() const
+    {
+        std::scoped_lock lock{m_error_mutex};
+        return m_error;
+    }
+
+private:
+    UringServerOptions m_options;
+    Handler m_handler;
+    mutable std::mutex m_error_mutex;
+    std::exception_ptr m_error;
+    std::vector<std::unique_ptr<internal::UringWorker<Handler>>> m_workers;
+    std::vector<std::jthread> m_threads;
+};
+
+} // namespace umb::net
+
+#endif // UMB_NET_HAS_IO_URING
+
+#endif // USCRIPT_MSGBUF_NET_URING_SERVER_HPP
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_OUTGOING_QUEUE_HPP
+#define USCRIPT_MSGBUF_OUTGOING_QUEUE_HPP
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "umb/constants.hpp"
+#include "umb/message.hpp"
+
+namespace umb
+{
+
+enum class FlushMode
+{
+    // Flush after every message. Messages queued while a
+    // write is in progress are still sent together.
+    immediate,
+    // Flush once all messages of a received batch are handled.
+    end_of_batch,
+    // Flush when FlushPolicy::max_bytes are queued or the oldest
+    // queued message has waited for FlushPolicy::max_delay.
+    threshold,
+};
+
+struct FlushPolicy
+{
+    FlushMode mode{FlushMode::end_of_batch};
+    std::size_t max_bytes{64 * 1024};
+    std::chrono::microseconds max_delay{1000};
+};
+
+/**
+ * Per-connection queue of outgoing packets. Messages are framed into
+ * a pending buffer that is written out with a single write. While a
+ * write is in progress, new messages go to a second buffer, which is
+ * swapped in for the next write. Buffer capacity is reused.
+ *
+ * Not thread safe, meant to be used from the connection's strand.
+ */
+class OutgoingQueue
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit OutgoingQueue(FlushPolicy policy = {})
+        : m_policy(policy)
+    {
+    }
+
+    /**
+     * Queue framed packets of \msg.
+     */
+    void push(const Message& msg, clock::time_point now = clock::now())
+    {
+        if (m_pending.empty())
+        {
+            m_first_pending = now;
+        }
+        msg.to_packets(m_pending);
+        if (m_policy.mode == FlushMode::immediate
+            || (m_policy.mode == FlushMode::threshold && m_pending.size() >= m_policy.max_bytes))
+        {
+            m_flush_requested = true;
+        }
+    }
+
+    /**
+     * Signal that all messages of a received batch are queued.
+     */
+    constexpr void end_batch() noexcept
+    {
+        if (m_policy.mode == FlushMode::end_of_batch && !m_pending.empty())
+        {
+            m_flush_requested = true;
+        }
+    }
+
+    /**
+     * True if the pending packets should be written now.
+     */
+    [[nodiscard]] bool flush_due(clock::time_point now = clock::now()) const noexcept
+    {
+        return !m_pending.empty() && (m_flush_requested || now >= deadline());
+    }
+
+    /**
+     * Time at which the pending packets are due at the latest.
+     */
+    [[nodiscard]] clock::time_point deadline() const noexcept
+    {
+        if (m_pending.empty() || m_policy.mode != FlushMode::threshold)
+        {
+            return clock::time_point::max();
+        }
+        return m_first_pending + m_policy.max_delay;
+    }
+
+    /**
+     * Move the pending packets to the in-flight buffer and return them.
+     * The bytes must stay untouched until end_flush() is called.
+     */
+    [[nodiscard]] std::span<const byte> begin_flush() noexcept
+    {
+        std::swap(m_pending, m_in_flight);
+        m_flush_requested = false;
+        return m_in_flight;
+    }
+
+    /**
+     * Release the in-flight buffer after the write has completed.
+     */
+    constexpr void end_flush() noexcept
+    {
+        m_in_flight.clear();
+    }
+
+    [[nodiscard]] constexpr std::size_t pending_bytes() const noexcept
+    {
+        return m_pending.size();
+    }
+
+    [[nodiscard]] constexpr const FlushPolicy& policy() const noexcept
+    {
+        return m_policy;
+    }
+
+private:
+    FlushPolicy m_policy;
+    std::vector<byte> m_pending;
+    std::vector<byte> m_in_flight;
+    clock::time_point m_first_pending{};
+    bool m_flush_requested{false};
+};
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_OUTGOING_QUEUE_HPP
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_PACKETS_HPP
+#define USCRIPT_MSGBUF_PACKETS_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <vector>
+
+#include "umb/coding.hpp"
+#include "umb/constants.hpp"
+
+namespace umb
+{
+
+/**
+ * Number of packets needed to send an encoded message.
+ * Every packet after the first one repeats the header.
+ *
+ * @param serialized_size encoded message size, see Message::serialized_size().
+ * @return number of packets, at least 1.
+ */
+[[nodiscard]] constexpr std::size_t packet_count(std::size_t serialized_size) noexcept
+{
+    if (serialized_size <= g_packet_size)
+    {
+        return 1;
+    }
+    const auto payload_size = serialized_size - g_header_size;
+    return (payload_size + g_payload_size - 1) / g_payload_size;
+}
+
+/**
+ * Total size of all packets of an encoded message, headers included.
+ */
+[[nodiscard]] constexpr std::size_t framed_size(std::size_t serialized_size) noexcept
+{
+    return serialized_size + (packet_count(serialized_size) - 1) * g_header_size;
+}
+
+/**
+ * Part field of packet \index out of \count packets.
+ */
+[[nodiscard]] constexpr byte packet_part(std::size_t index, std::size_t count) noexcept
+{
+    if (count == 1)
+    {
+        return g_part_single_part;
+    }
+    if (index == count - 1)
+    {
+        return g_part_multi_part_end;
+    }
+    return static_cast<byte>(index);
+}
+
+namespace internal
+{
+
+[[nodiscard]] constexpr uint16_t encoded_message_type(std::span<const byte> encoded) noexcept
+{
+    return static_cast<uint16_t>(load_le<uint32_t>(encoded.data()) >> 16);
+}
+
+// Payload size of packet \index of a message of \serialized_size bytes.
+[[nodiscard]] constexpr std::size_t
+packet_payload_size(std::size_t index, std::size_t serialized_size) noexcept
+{
+    const auto payload_size = serialized_size - g_header_size;
+    return std::min(g_payload_size, payload_size - index * g_payload_size);
+}
+
+} // namespace internal
+
+/**
+ * Split an encoded message at the end of \buffer into framed
+ * packets in place, inserting a header in front of every packet
+ * after the first one. Packets are moved back to front, the
+ * payload is never copied to a separate send buffer.
+ *
+ * @param buffer buffer holding a single encoded message
+ *  from \offset to the end, e.g. from Message::encode_append().
+ * @param offset offset of the encoded message in \buffer.
+ */
+inline void frame_packets_in_place(std::vector<byte>& buffer, std::size_t offset)
+{
+    const auto size = buffer.size() - offset;
+    const auto count = packet_count(size);
+    if (count == 1)
+    {
+        return;
+    }
+
+    const auto type = internal::encoded_message_type(std::span{buffer}.subspan(offset));
+    buffer.resize(offset + framed_size(size));
+    const auto begin = buffer.begin() + static_cast<std::ptrdiff_t>(offset);
+
+    // The first packet header is written by the encoder.
+    for (auto i = count - 1; i > 0; --i)
+    {
+        const auto payload_size = internal::packet_payload_size(i, size);
+        const auto src = begin + static_cast<std::ptrdiff_t>(g_header_size + i * g_payload_size);
+        const auto dst = begin + static_cast<std::ptrdiff_t>(i * g_packet_size);
+        std::copy_backward(
+            src,
+            src + static_cast<std::ptrdiff_t>(payload_size),
+            dst + static_cast<std::ptrdiff_t>(g_header_size + payload_size));
+
+        auto hi = std::span{buffer}.subspan(offset + i * g_packet_size).begin();
+        encode_header(static_cast<byte>(g_header_size + payload_size), packet_part(i, count), type, hi);
+    }
+}
+
+/**
+ * Scatter-gather list of the framed packets of an encoded message.
+ * Payload buffers point into the encoded message, only the headers
+ * of packets after the first one are stored here. Reuse an instance
+ * to avoid allocations.
+ */
+class PacketFrames
+{
+public:
+    /**
+     * Frame \encoded into packets. The returned buffers are written
+     * to the wire in order. They are valid until the next call and
+     * while \encoded is alive.
+     *
+     * @param encoded a single encoded message, e.g. from Message::to_bytes().
+     * @return header and payload buffers of all packets.
+     */
+    [[nodiscard]] std::span<const std::span<const byte>> frame(std::span<const byte> encoded)
+    {
+        const auto count = packet_count(encoded.size());
+        m_buffers.clear();
+        if (count == 1)
+        {
+            m_buffers.push_back(encoded);
+            return m_buffers;
+        }
+
+        // Headers must not be reallocated after spans to them are taken.
+        m_headers.resize(count - 1);
+        const auto type = internal::encoded_message_type(encoded);
+
+        // The first packet, including its header, is used as is.
+        m_buffers.push_back(encoded.first(g_packet_size));
+        for (std::size_t i = 1; i < count; ++i)
+        {
+            const auto payload_size = internal::packet_payload_size(i, encoded.size());
+            auto& header = m_headers[i - 1];
+            auto hi = std::span<byte>{header}.begin();
+            encode_header(static_cast<byte>(g_header_size + payload_size), packet_part(i, count), type, hi);
+            m_buffers.emplace_back(header);
+            m_buffers.push_back(encoded.subspan(g_header_size + i * g_payload_size, payload_size));
+        }
+        return m_buffers;
+    }
+
+private:
+    std::vector<std::array<byte, g_header_size>> m_headers;
+    std::vector<std::span<const byte>> m_buffers;
+};
+
+/**
+ * Reads fields of a multipart message directly from its packets,
+ * without first reassembling the payload into one buffer. Only a
+ * field that crosses a packet boundary is copied, into bounded
+ * scratch storage.
+ */
+class PartReader
+{
+public:
+    /**
+     * @param parts all packets of one message in order, each
+     *  including its header. Must outlive the reader.
+     */
+    constexpr explicit PartReader(std::span<const std::span<const byte>> parts) noexcept
+        : m_parts(parts)
+    {
+        if (!m_parts.empty())
+        {
+            m_current = payload(m_parts.front());
+        }
+    }
+
+    /**
+     * Return the next \n bytes of the message as a contiguous span.
+     * The span is valid until the next call.
+     */
+    [[nodiscard]] constexpr std::expected<std::span<const byte>, DecodeError>
+    next(std::size_t n) noexcept
+    {
+        while (m_current.empty() && m_part + 1 < m_parts.size())
+        {
+            m_current = payload(m_parts[++m_part]);
+        }
+
+        if (m_current.size() >= n)
+        {
+            const auto field = m_current.first(n);
+            m_current = m_current.subspan(n);
+            m_offset += n;
+            return field;
+        }
+
+        if (n > m_scratch.size())
+        {
+            return std::unexpected(DecodeError::capacity_exceeded);
+        }
+
+        std::size_t copied = 0;
+        while (copied < n)
+        {
+            if (m_current.empty())
+            {
+                if (m_part + 1 >= m_parts.size())
+                {
+                    return std::unexpected(DecodeError::not_enough_bytes);
+                }
+                m_current = payload(m_parts[++m_part]);
+                continue;
+            }
+            const auto num = std::min(n - copied, m_current.size());
+            std::copy_n(m_current.begin(), num, m_scratch.begin() + static_cast<std::ptrdiff_t>(copied));
+            m_current = m_current.subspan(num);
+            copied += num;
+        }
+        m_offset += n;
+        return std::span<const byte>{m_scratch}.first(n);
+    }
+
+    /**
+     * Return the next dynamic field, its size header included.
+     *
+     * @param element_size size of one element counted by the size
+     *  header: g_sizeof_uscript_char for strings, 1 for bytes and floats.
+     */
+    [[nodiscard]] constexpr std::expected<std::span<const byte>, DecodeError>
+    next_dynamic(std::size_t element_size) noexcept
+    {
+        while (m_current.empty() && m_part + 1 < m_parts.size())
+        {
+            m_current = payload(m_parts[++m_part]);
+        }
+        if (m_current.empty())
+        {
+            return std::unexpected(DecodeError::not_enough_bytes);
+        }
+        return next(g_dynamic_field_header_size + m_current.front() * element_size);
+    }
+
+    /**
+     * Offset of the next field from the start of the message,
+     * counting the first packet header only.
+     */
+    [[nodiscard]] constexpr std::size_t offset() const noexcept
+    {
+        return m_offset;
+    }
+
+private:
+    [[nodiscard]] static constexpr std::span<const byte> payload(std::span<const byte> part) noexcept
+    {
+        return part.size() > g_header_size ? part.subspan(g_header_size) : std::span<const byte>{};
+    }
+
+    std::span<const std::span<const byte>> m_parts;
+    std::size_t m_part{0};
+    std::span<const byte> m_current{};
+    std::size_t m_offset{g_header_size};
+    // Fits the largest dynamic field, a string of g_max_dynamic_size characters.
+    std::array<byte, g_dynamic_field_header_size + g_max_dynamic_size * g_sizeof_uscript_char> m_scratch{};
+};
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_PACKETS_HPP
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_POOL_HPP
+#define USCRIPT_MSGBUF_POOL_HPP
+
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "umb/message.hpp"
+
+namespace umb
+{
+
+// Default maximum number of idle messages kept by a MessagePool.
+constexpr std::size_t g_default_pool_size = 64;
+
+/**
+ * Takes back messages handed out by a pool.
+ */
+class MessageRecycler
+{
+public:
+    virtual void recycle(Message* msg) noexcept = 0;
+
+protected:
+    ~MessageRecycler() = default;
+};
+
+/**
+ * unique_ptr deleter that returns the message to its pool
+ * instead of deleting it.
+ */
+struct PooledMessageDeleter
+{
+    MessageRecycler* pool{nullptr};
+
+    void operator()(Message* msg) const noexcept
+    {
+        pool->recycle(msg);
+    }
+};
+
+/**
+ * Message handed out by a pool. Converts to Pooled<Message>.
+ */
+template<typename T>
+using Pooled = std::unique_ptr<T, PooledMessageDeleter>;
+
+/**
+ * Hands out recycled messages of type T. Returned messages are
+ * reset() and kept for reuse, so the capacity of their dynamic
+ * fields is reused too. Not thread safe: use one pool per thread,
+ * and return messages on the thread that acquired them. The pool
+ * must outlive all messages it has handed out.
+ *
+ * @tparam T generated message type.
+ */
+template<typename T>
+    requires std::derived_from<T, Message>
+class MessagePool final : public MessageRecycler
+{
+public:
+    /**
+     * @param max_free maximum number of idle messages to keep.
+     *  Messages returned to a full pool are deleted.
+     */
+    explicit MessagePool(std::size_t max_free = g_default_pool_size)
+        : m_max_free(max_free)
+    {
+        // Never reallocate in recycle.
+        m_free.reserve(max_free);
+    }
+
+    MessagePool(const MessagePool&) = delete;
+
+    MessagePool& operator=(const MessagePool&) = delete;
+
+    ~MessagePool() = default;
+
+    /**
+     * Return an idle message, or a new one if there are none.
+     * The message is in its default state.
+     */
+    [[nodiscard]] Pooled<T> acquire()
+    {
+        if (m_free.empty())
+        {
+            return Pooled<T>{new T(), PooledMessageDeleter{this}};
+        }
+        T* msg = m_free.back().release();
+        m_free.pop_back();
+        return Pooled<T>{msg, PooledMessageDeleter{this}};
+    }
+
+    [[nodiscard]] std::size_t free_count() const noexcept
+    {
+        return m_free.size();
+    }
+
+    void recycle(Message* msg) noexcept override
+    {
+        auto* t = static_cast<T*>(msg);
+        if (m_free.size() >= m_max_free)
+        {
+            delete t;
+            return;
+        }
+        t->reset();
+        m_free.emplace_back(t);
+    }
+
+private:
+    std::vector<std::unique_ptr<T>> m_free;
+    std::size_t m_max_free;
+};
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_POOL_HPP
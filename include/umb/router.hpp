@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_ROUTER_HPP
+#define USCRIPT_MSGBUF_ROUTER_HPP
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "umb/coding.hpp"
+#include "umb/outgoing_queue.hpp"
+#include "umb/pool.hpp"
+#include "umb/stream_parser.hpp"
+
+namespace umb
+{
+
+/**
+ * Dispatches received messages to handlers registered per message type.
+ * Generated code declares it as Router<Result> for every message file.
+ *
+ * Dispatch indexes a flat table with the message type, decodes the
+ * message and calls its handler with the connection's outgoing queue.
+ * Messages with a static size are decoded on the stack by synchronous
+ * routers, all others are taken from the calling thread's message pool.
+ * Once the pool is warmed up, dispatch does not allocate.
+ *
+ * With a coroutine Result, such as boost::asio::awaitable<void>, the
+ * decoded message is kept alive until the handler completes, and the
+ * handler must resume on the thread it was dispatched on. Handlers must
+ * not outlive the router or the queue.
+ *
+ * Routers are meant to be shared by all connections and threads once
+ * all handlers are registered. Pass std::cref(router) to servers that
+ * copy their handler for every connection.
+ *
+ * @tparam PoolFn returns the calling thread's generated MessagePool.
+ * @tparam Result return type of all handlers: void, or a coroutine
+ *  type that can co_await itself.
+ * @tparam Messages generated message types in MessageType order.
+ */
+template<auto PoolFn, typename Result, typename... Messages>
+class BasicRouter
+{
+public:
+    template<typename T>
+    using Handler = std::function<Result(const T&, OutgoingQueue&)>;
+
+    using ErrorHandler = std::function<Result(const StreamMessage&, const MessageDecodeError&, OutgoingQueue&)>;
+
+    /**
+     * Handle messages of type T with \handler, invoked as
+     * handler(const T& msg, OutgoingQueue& queue).
+     */
+    template<typename T, typename Fn>
+    void on(Fn handler)
+    {
+        static_assert((std::is_same_v<T, Messages> || ...), "T is not a message of this router");
+        std::get<Handler<T>>(m_handlers) = std::move(handler);
+    }
+
+    /**
+     * Answer requests of type Req with a Resp. \handler is invoked as
+     * handler(const Req& req, Resp& resp) with a pooled response in its
+     * default state. Once the handler returns, or completes for coroutine
+     * routers, the response is framed directly into the outgoing queue.
+     */
+    template<typename Req, typename Resp, typename Fn>
+    void on_request(Fn handler)
+    {
+        on<Req>([handler = std::move(handler)](const Req& req, OutgoingQueue& queue) -> Result
+                {
+                    return respond<Resp>(handler, req, queue);
+                });
+    }
+
+    /**
+     * Handle messages that fail to decode. The error is
+     * DecodeError::unhandled_message_type for messages without a
+     * registered handler, and DecodeError::unknown_message_type for
+     * types that do not exist. They are dropped by default.
+     */
+    template<typename Fn>
+    void on_error(Fn handler)
+    {
+        m_on_error = std::move(handler);
+    }
+
+    /**
+     * Decode \msg and pass it to the handler registered for its type.
+     */
+    Result operator()(const StreamMessage& msg, OutgoingQueue& queue) const
+    {
+        using DispatchFn = Result (*)(const BasicRouter&, const StreamMessage&, OutgoingQueue&);
+        // Indexed by MessageType.
+        static constexpr std::array<DispatchFn, sizeof...(Messages) + 1> table{
+            nullptr,
+            &BasicRouter::dispatch_as<Messages>...,
+        };
+
+        if (msg.type == 0 || msg.type >= table.size())
+        {
+            return unhandled(msg, {.error = DecodeError::unknown_message_type}, queue);
+        }
+        return table[msg.type](*this, msg, queue);
+    }
+
+private:
+    template<typename T>
+    static Result dispatch_as(const BasicRouter& router, const StreamMessage& msg, OutgoingQueue& queue)
+    {
+        const auto& handler = std::get<Handler<T>>(router.m_handlers);
+        if (!handler)
+        {
+            return router.unhandled(msg, {.error = DecodeError::unhandled_message_type}, queue);
+        }
+
+        if constexpr (std::is_void_v<Result> && T::has_static_size())
+        {
+            // No dynamic fields, nothing to reuse from a pool.
+            T decoded;
+            if (const auto result = decoded.try_from_parts(msg.parts); !result)
+            {
+                return router.unhandled(msg, result.error(), queue);
+            }
+            return handler(decoded, queue);
+        }
+        else
+        {
+            auto decoded = PoolFn().template acquire<T>();
+            if (const auto result = decoded->try_from_parts(msg.parts); !result)
+            {
+                return router.unhandled(msg, result.error(), queue);
+            }
+            if constexpr (std::is_void_v<Result>)
+            {
+                return handler(*decoded, queue);
+            }
+            else
+            {
+                return invoke_async<T>(handler, std::move(decoded), queue);
+            }
+        }
+    }
+
+    // Keeps \msg alive until \handler completes.
+    template<typename T>
+    static Result invoke_async(const Handler<T>& handler, Pooled<T> msg, OutgoingQueue& queue)
+    {
+        co_await handler(*msg, queue);
+    }
+
+    template<typename Resp, typename Fn, typename Req>
+    static Result respond(const Fn& handler, const Req& req, OutgoingQueue& queue)
+    {
+        if constexpr (std::is_void_v<Result>)
+        {
+            const auto resp = PoolFn().template acquire<Resp>();
+            handler(req, *resp);
+            queue.push(*resp);
+        }
+        else
+        {
+            return respond_async<Resp>(handler, req, queue);
+        }
+    }
+
+    template<typename Resp, typename Fn, typename Req>
+    static Result respond_async(const Fn& handler, const Req& req, OutgoingQueue& queue)
+    {
+        const auto resp = PoolFn().template acquire<Resp>();
+        co_await handler(req, *resp);
+        queue.push(*resp);
+    }
+
+    static Result ignore()
+    {
+        co_return;
+    }
+
+    Result unhandled(const StreamMessage& msg, const MessageDecodeError& error, OutgoingQueue& queue) const
+    {
+        if (m_on_error)
+        {
+            return m_on_error(msg, error, queue);
+        }
+        if constexpr (!std::is_void_v<Result>)
+        {
+            return ignore();
+        }
+    }
+
+    std::tuple<Handler<Messages>...> m_handlers;
+    ErrorHandler m_on_error;
+};
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_ROUTER_HPP
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_STREAM_PARSER_HPP
+#define USCRIPT_MSGBUF_STREAM_PARSER_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "umb/coding.hpp"
+#include "umb/constants.hpp"
+
+namespace umb
+{
+
+enum class StreamError
+{
+    // Packet size field is smaller than the packet header.
+    invalid_packet_size,
+    // Multipart packet received out of order, or a single
+    // part packet received in the middle of a multipart message.
+    unexpected_part,
+    // Multipart packet type differs from the first part.
+    message_type_mismatch,
+};
+
+/**
+ * A complete message parsed from a byte stream.
+ */
+struct StreamMessage
+{
+    uint16_t type{0};
+    // Packets of the message in order, each including its header.
+    // Single part messages have exactly one packet, which holds the
+    // whole encoded message. Can be decoded with Message::try_from_parts().
+    std::span<const std::span<const byte>> parts{};
+
+    [[nodiscard]] constexpr bool is_single_part() const noexcept
+    {
+        return parts.size() == 1 && parts.front()[1] == g_part_single_part;
+    }
+};
+
+/**
+ * Incremental UMB packet parser for stream transports such as TCP.
+ * Bytes are pushed in chunks of any size, packet and message boundaries
+ * do not need to line up with them.
+ *
+ * Packets fully contained in a pushed chunk are returned in place,
+ * including all parts of a multipart message within one chunk. Only
+ * a packet split across two chunks, and the parts of a multipart
+ * message spanning more than one chunk, are copied into storage owned
+ * by the parser. The storage is reused, once warmed up the parser
+ * does not allocate.
+ *
+ * After an error the stream is out of sync and the parser must be reset.
+ */
+class StreamParser
+{
+public:
+    /**
+     * Start parsing \chunk. Bytes of a previous chunk not yet
+     * consumed by next() are discarded. \chunk must stay alive
+     * until next() returns no message.
+     */
+    constexpr void feed(std::span<const byte> chunk) noexcept
+    {
+        m_input = chunk;
+    }
+
+    /**
+     * Parse the next complete message from the fed chunk. The returned
+     * message is valid until the next call to next(), feed() or push().
+     *
+     * @return the next message, std::nullopt if more bytes are
+     *         needed, or an error if the stream is malformed.
+     */
+    [[nodiscard]] std::expected<std::optional<StreamMessage>, StreamError> next()
+    {
+        while (true)
+        {
+            const auto packet = next_packet();
+            if (!packet)
+            {
+                return std::unexpected(packet.error());
+            }
+            if (packet->empty())
+            {
+                keep_parts();
+                return std::nullopt;
+            }
+
+            const byte part = (*packet)[1];
+            const auto type = load_le<uint16_t>(packet->data() + 2);
+
+            if (part == g_part_single_part)
+            {
+                if (m_num_parts > 0)
+                {
+                    return std::unexpected(StreamError::unexpected_part);
+                }
+                m_single[0] = *packet;
+                return StreamMessage{.type = type, .parts = m_single};
+            }
+
+            if (m_num_parts == 0)
+            {
+                if (part != 0)
+                {
+                    return std::unexpected(StreamError::unexpected_part);
+                }
+                m_multipart_type = type;
+            }
+            else if (type != m_multipart_type)
+            {
+                return std::unexpected(StreamError::message_type_mismatch);
+            }
+            else if (part != m_num_parts && part != g_part_multi_part_end)
+            {
+                return std::unexpected(StreamError::unexpected_part);
+            }
+
+            if (m_num_parts == 0)
+            {
+                m_part_spans.clear();
+            }
+            // A packet gathered in m_partial is overwritten by the next split packet.
+            m_part_spans.push_back(packet->data() == m_partial.data() ? keep_part(m_num_parts, *packet) : *packet);
+            ++m_num_parts;
+
+            if (part == g_part_multi_part_end)
+            {
+                m_num_parts = 0;
+                return StreamMessage{.type = m_multipart_type, .parts = m_part_spans};
+            }
+        }
+    }
+
+    /**
+     * Parse \chunk and invoke \on_message for every complete message.
+     * Messages are valid for the duration of the callback only.
+     *
+     * @return number of messages parsed, or an error if the
+     *         stream is malformed.
+     */
+    template<typename OnMessage>
+    requires std::invocable<OnMessage&, const StreamMessage&>
+    std::expected<std::size_t, StreamError> push(std::span<const byte> chunk, OnMessage&& on_message)
+    {
+        feed(chunk);
+        std::size_t count = 0;
+        while (true)
+        {
+            const auto msg = next();
+            if (!msg)
+            {
+                return std::unexpected(msg.error());
+            }
+            if (!msg->has_value())
+            {
+                return count;
+            }
+            on_message(**msg);
+            ++count;
+        }
+    }
+
+    /**
+     * Discard all buffered bytes, e.g. after an error.
+     */
+    constexpr void reset() noexcept
+    {
+        m_input = {};
+        m_partial_size = 0;
+        m_num_parts = 0;
+    }
+
+    /**
+     * True if a packet or a multipart message is partially received.
+     */
+    [[nodiscard]] constexpr bool in_progress() const noexcept
+    {
+        return m_partial_size > 0 || m_num_parts > 0;
+    }
+
+private:
+    // Return the next complete packet, an empty span if more bytes are needed.
+    [[nodiscard]] std::expected<std::span<const byte>, StreamError> next_packet() noexcept
+    {
+        if (m_partial_size == 0
+            && m_input.size() >= g_header_size
+            && m_input.size() >= m_input.front())
+        {
+            const auto size = m_input.front();
+            if (size < g_header_size)
+            {
+                return std::unexpected(StreamError::invalid_packet_size);
+            }
+            const auto packet = m_input.first(size);
+            m_input = m_input.subspan(size);
+            return packet;
+        }
+
+        // Packet split across chunks, gather it into m_partial.
+        if (m_partial_size < g_header_size)
+        {
+            fill_partial(g_header_size);
+            if (m_partial_size < g_header_size)
+            {
+                return std::span<const byte>{};
+            }
+        }
+        const auto size = m_partial[0];
+        if (size < g_header_size)
+        {
+            return std::unexpected(StreamError::invalid_packet_size);
+        }
+        fill_partial(size);
+        if (m_partial_size < size)
+        {
+            return std::span<const byte>{};
+        }
+        m_partial_size = 0;
+        return std::span<const byte>{m_partial}.first(size);
+    }
+
+    // Copy \packet into the storage of part \index.
+    std::span<const byte> keep_part(std::size_t index, std::span<const byte> packet)
+    {
+        while (m_parts.size() <= index)
+        {
+            m_parts.emplace_back();
+        }
+        std::copy(packet.begin(), packet.end(), m_parts[index].begin());
+        return {m_parts[index].data(), packet.size()};
+    }
+
+    // Copy the parts received so far that still point into the fed
+    // chunk, which is released once next() asks for more bytes.
+    void keep_parts()
+    {
+        for (std::size_t i = 0; i < m_num_parts; ++i)
+        {
+            if (i >= m_parts.size() || m_part_spans[i].data() != m_parts[i].data())
+            {
+                m_part_spans[i] = keep_part(i, m_part_spans[i]);
+            }
+        }
+    }
+
+    constexpr void fill_partial(std::size_t size) noexcept
+    {
+        const auto num = std::min(size - m_partial_size, m_input.size());
+        std::copy_n(m_input.begin(), num, m_partial.begin() + static_cast<std::ptrdiff_t>(m_partial_size));
+        m_partial_size += num;
+        m_input = m_input.subspan(num);
+    }
+
+    std::span<const byte> m_input{};
+    std::array<byte, g_packet_size> m_partial{};
+    std::size_t m_partial_size{0};
+    std::array<std::span<const byte>, 1> m_single{};
+    // Deque, so growing it does not move parts already referenced by m_part_spans.
+    std::deque<std::array<byte, g_packet_size>> m_parts;
+    // Parts of the current multipart message, in place or in m_parts.
+    std::vector<std::span<const byte>> m_part_spans;
+    std::size_t m_num_parts{0};
+    uint16_t m_multipart_type{0};
+};
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_STREAM_PARSER_HPP
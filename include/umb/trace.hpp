@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_TRACE_HPP
+#define USCRIPT_MSGBUF_TRACE_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "umb/coding.hpp"
+#include "umb/constants.hpp"
+#include "umb/stream_parser.hpp"
+
+namespace umb
+{
+
+// Trace files start with this, followed by g_trace_version as a little-endian uint32.
+constexpr std::array<char, 8> g_trace_magic{'U', 'M', 'B', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t g_trace_version = 1;
+// Encoded size of a TraceRecord without its snapshot.
+constexpr std::size_t g_trace_record_header_size = 24;
+
+/**
+ * One traced message.
+ */
+struct TraceRecord
+{
+    // System clock time the message was handled at.
+    std::chrono::sys_time<std::chrono::nanoseconds> timestamp{};
+    uint64_t connection_id{0};
+    // Header of the message's first packet.
+    uint16_t type{0};
+    byte size{0};
+    byte part{0};
+    uint16_t num_parts{0};
+    uint16_t snapshot_size{0};
+    // Leading bytes of the first packet, including its header.
+    std::array<byte, g_packet_size> snapshot{};
+
+    [[nodiscard]] constexpr std::span<const byte> snapshot_bytes() const noexcept
+    {
+        return std::span{snapshot}.first(snapshot_size);
+    }
+
+    // True if the snapshot holds the whole message and it can be decoded.
+    [[nodiscard]] constexpr bool is_complete() const noexcept
+    {
+        return num_parts == 1 && part == g_part_single_part && snapshot_size == size;
+    }
+};
+
+enum class TraceError : uint8_t
+{
+    invalid_header,
+    unsupported_version,
+    truncated_record,
+};
+
+struct TraceOptions
+{
+    // Trace every Nth message handled by a thread, 0 disables tracing.
+    uint32_t sample_every{1};
+    // Number of leading packet bytes to copy into each record.
+    // g_packet_size captures whole single part messages.
+    std::size_t snapshot_bytes{0};
+    // Records buffered per thread between drains, rounded up to a power
+    // of two. Records are dropped while the buffer is full.
+    std::size_t ring_capacity{4096};
+};
+
+/**
+ * Single producer, single consumer ring of trace records.
+ * Owned by one producer thread, drained by Tracer::drain().
+ */
+class TraceRing
+{
+public:
+    TraceRing(std::size_t capacity, uint32_t sample_every)
+        : m_records(std::bit_ceil(std::max<std::size_t>(capacity, 2))),
+          m_mask(m_records.size() - 1),
+          m_sample_every(sample_every),
+          m_owner(std::this_thread::get_id())
+    {
+    }
+
+    /**
+     * Claim the next record if this message is sampled and there is
+     * room for it. Producer only. Must be followed by commit().
+     */
+    [[nodiscard]] TraceRecord* try_claim() noexcept
+    {
+        if (--m_countdown != 0)
+        {
+            return nullptr;
+        }
+        m_countdown = m_sample_every;
+
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head == m_records.size())
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head == m_records.size())
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+        }
+        return &m_records[tail & m_mask];
+    }
+
+    // Publish the record returned by try_claim(). Producer only.
+    void commit() noexcept
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * Pass all published records to \fn in order. Consumer only.
+     * @return number of records drained.
+     */
+    template<typename Fn>
+    std::size_t drain(Fn&& fn)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        const auto tail = m_tail.load(std::memory_order_acquire);
+        for (auto i = head; i != tail; ++i)
+        {
+            fn(std::as_const(m_records[i & m_mask]));
+        }
+        m_head.store(tail, std::memory_order_release);
+        return tail - head;
+    }
+
+    // Records dropped because the ring was full.
+    [[nodiscard]] uint64_t dropped() const noexcept
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::thread::id owner() const noexcept
+    {
+        return m_owner;
+    }
+
+private:
+    std::vector<TraceRecord> m_records;
+    std::size_t m_mask;
+    // Written by the consumer.
+    alignas(64) std::atomic<std::size_t> m_head{0};
+    // Written by the producer, with its producer-only state.
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+    std::size_t m_cached_head{0};
+    uint32_t m_sample_every;
+    uint32_t m_countdown{1};
+    std::atomic<uint64_t> m_dropped{0};
+    std::thread::id m_owner;
+};
+
+/**
+ * Binary tracer for received messages. Recording copies the header
+ * fields and an optional payload snapshot into the calling thread's
+ * TraceRing, without locking or allocating once the thread's ring
+ * exists. Records are drained to a trace file from another thread
+ * and turned into text offline, see read_trace().
+ */
+class Tracer
+{
+public:
+    explicit Tracer(TraceOptions options = {})
+        : m_options(options),
+          m_id(next_id())
+    {
+        m_options.snapshot_bytes = std::min(m_options.snapshot_bytes, g_packet_size);
+    }
+
+    Tracer(const Tracer&) = delete;
+
+    Tracer& operator=(const Tracer&) = delete;
+
+    [[nodiscard]] bool enabled() const noexcept
+    {
+        return m_options.sample_every != 0;
+    }
+
+    /**
+     * Record \msg received on \connection_id, if it is sampled.
+     */
+    void record(uint64_t connection_id, const StreamMessage& msg)
+    {
+        if (!enabled() || msg.parts.empty())
+        {
+            return;
+        }
+
+        auto& ring = thread_ring();
+        auto* rec = ring.try_claim();
+        if (!rec)
+        {
+            return;
+        }
+
+        const auto first = msg.parts.front();
+        rec->timestamp = std::chrono::time_point_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now());
+        rec->connection_id = connection_id;
+        rec->type = msg.type;
+        rec->size = first[0];
+        rec->part = first[1];
+        rec->num_parts = static_cast<uint16_t>(msg.parts.size());
+        rec->snapshot_size = static_cast<uint16_t>(std::min(m_options.snapshot_bytes, first.size()));
+        std::copy_n(first.begin(), rec->snapshot_size, rec->snapshot.begin());
+        ring.commit();
+    }
+
+    /**
+     * Write the records of all threads to \out, each thread's records
+     * in order. Threads are not ordered relative to each other.
+     * @return number of records written.
+     */
+    std::size_t drain(std::ostream& out)
+    {
+        std::array<byte, g_trace_record_header_size> header{};
+        std::scoped_lock lock{m_mutex};
+        std::size_t count = 0;
+        for (const auto& ring: m_rings)
+        {
+            count += ring->drain([&](const TraceRecord& rec)
+                                 {
+                                     store_le(rec.timestamp.time_since_epoch().count(), header.data());
+                                     store_le(rec.connection_id, header.data() + 8);
+                                     store_le(rec.type, header.data() + 16);
+                                     header[18] = rec.size;
+                                     header[19] = rec.part;
+                                     store_le(rec.num_parts, header.data() + 20);
+                                     store_le(rec.snapshot_size, header.data() + 22);
+                                     write_bytes(out, header);
+                                     write_bytes(out, rec.snapshot_bytes());
+                                 });
+        }
+        return count;
+    }
+
+    // Total records dropped on all threads.
+    [[nodiscard]] uint64_t dropped() const
+    {
+        std::scoped_lock lock{m_mutex};
+        uint64_t total = 0;
+        for (const auto& ring: m_rings)
+        {
+            total += ring->dropped();
+        }
+        return total;
+    }
+
+    [[nodiscard]] const TraceOptions& options() const noexcept
+    {
+        return m_options;
+    }
+
+private:
+    static uint64_t next_id() noexcept
+    {
+        static std::atomic<uint64_t> id{0};
+        return id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    static void write_bytes(std::ostream& out, std::span<const byte> bytes)
+    {
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    TraceRing& thread_ring()
+    {
+        // Threads usually record into one tracer, so cache its ring.
+        thread_local uint64_t cached_id{0};
+        thread_local TraceRing* cached_ring{nullptr};
+        if (cached_id == m_id)
+        {
+            return *cached_ring;
+        }
+
+        std::scoped_lock lock{m_mutex};
+        const auto self = std::this_thread::get_id();
+        const auto it = std::ranges::find_if(m_rings, [self](const auto& ring)
+        {
+            return ring->owner() == self;
+        });
+        if (it != m_rings.end())
+        {
+            cached_ring = it->get();
+        }
+        else
+        {
+            cached_ring = m_rings.emplace_back(std::make_unique<TraceRing>(
+                m_options.ring_capacity, m_options.sample_every)).get();
+        }
+        cached_id = m_id;
+        return *cached_ring;
+    }
+
+    TraceOptions m_options;
+    uint64_t m_id;
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<TraceRing>> m_rings;
+};
+
+/**
+ * Write the trace file header to \out, before any Tracer::drain().
+ */
+inline void write_trace_header(std::ostream& out)
+{
+    std::array<byte, sizeof(g_trace_magic) + sizeof(g_trace_version)> header{};
+    std::copy_n(reinterpret_cast<const byte*>(g_trace_magic.data()), g_trace_magic.size(), header.begin());
+    store_le(g_trace_version, header.data() + g_trace_magic.size());
+    out.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+}
+
+/**
+ * Read a trace file from \in and pass every record to \fn.
+ * @return number of records read.
+ */
+template<typename Fn>
+std::expected<std::size_t, TraceError> read_trace(std::istream& in, Fn&& fn)
+{
+    const auto read_bytes = [&in](std::span<byte> bytes)
+    {
+        in.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        return static_cast<std::size_t>(in.gcount());
+    };
+
+    std::array<byte, sizeof(g_trace_magic) + sizeof(g_trace_version)> file_header{};
+    if (read_bytes(file_header) != file_header.size()
+        || !std::equal(g_trace_magic.begin(), g_trace_magic.end(), file_header.begin()))
+    {
+        return std::unexpected(TraceError::invalid_header);
+    }
+    if (load_le<uint32_t>(file_header.data() + g_trace_magic.size()) != g_trace_version)
+    {
+        return std::unexpected(TraceError::unsupported_version);
+    }
+
+    std::size_t count = 0;
+    TraceRecord rec;
+    std::array<byte, g_trace_record_header_size> header{};
+    for (;;)
+    {
+        const auto num_read = read_bytes(header);
+        if (num_read == 0)
+        {
+            return count;
+        }
+        if (num_read != header.size())
+        {
+            return std::unexpected(TraceError::truncated_record);
+        }
+
+        rec.timestamp = std::chrono::sys_time<std::chrono::nanoseconds>{
+            std::chrono::nanoseconds{load_le<int64_t>(header.data())}};
+        rec.connection_id = load_le<uint64_t>(header.data() + 8);
+        rec.type = load_le<uint16_t>(header.data() + 16);
+        rec.size = header[18];
+        rec.part = header[19];
+        rec.num_parts = load_le<uint16_t>(header.data() + 20);
+        rec.snapshot_size = load_le<uint16_t>(header.data() + 22);
+        if (rec.snapshot_size > rec.snapshot.size()
+            || read_bytes(std::span{rec.snapshot}.first(rec.snapshot_size)) != rec.snapshot_size)
+        {
+            return std::unexpected(TraceError::truncated_record);
+        }
+        fn(std::as_const(rec));
+        ++count;
+    }
+}
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_TRACE_HPP
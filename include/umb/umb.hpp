@@ -42,6 +42,12 @@
 #include "umb/floatcmp.hpp"
 #include "umb/fmt.hpp"
 #include "umb/message.hpp"
+#include "umb/outgoing_queue.hpp"
+#include "umb/packets.hpp"
+#include "umb/pool.hpp"
+#include "umb/router.hpp"
+#include "umb/stream_parser.hpp"
+#include "umb/view.hpp"
 
 #ifdef UMB_INCLUDE_META
 
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USCRIPT_MSGBUF_VIEW_HPP
+#define USCRIPT_MSGBUF_VIEW_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "umb/coding.hpp"
+#include "umb/constants.hpp"
+
+namespace umb
+{
+
+/**
+ * Read-only view of a UMB wire format string payload, i.e. UCS-2
+ * characters in little-endian byte order. Characters are decoded
+ * on access. Does not own the underlying bytes.
+ */
+class Ucs2View
+{
+public:
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = char16_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = char16_t;
+
+        constexpr const_iterator() noexcept = default;
+
+        constexpr explicit const_iterator(const byte* p) noexcept
+            : m_p(p)
+        {
+        }
+
+        [[nodiscard]] constexpr char16_t operator*() const noexcept
+        {
+            return static_cast<char16_t>(load_le<uint16_t>(m_p));
+        }
+
+        constexpr const_iterator& operator++() noexcept
+        {
+            m_p += g_sizeof_uscript_char;
+            return *this;
+        }
+
+        constexpr const_iterator operator++(int) noexcept
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        [[nodiscard]] constexpr bool operator==(const const_iterator& other) const noexcept = default;
+
+    private:
+        const byte* m_p{nullptr};
+    };
+
+    constexpr Ucs2View() noexcept = default;
+
+    /**
+     * @param payload string payload bytes without the size header.
+     *  Must hold an even number of bytes.
+     */
+    constexpr explicit Ucs2View(std::span<const byte> payload) noexcept
+        : m_payload(payload)
+    {
+    }
+
+    [[nodiscard]] constexpr std::size_t size() const noexcept
+    {
+        return m_payload.size() / g_sizeof_uscript_char;
+    }
+
+    [[nodiscard]] constexpr bool empty() const noexcept
+    {
+        return m_payload.empty();
+    }
+
+    [[nodiscard]] constexpr char16_t operator[](std::size_t i) const noexcept
+    {
+        return static_cast<char16_t>(load_le<uint16_t>(m_payload.data() + i * g_sizeof_uscript_char));
+    }
+
+    [[nodiscard]] constexpr const_iterator begin() const noexcept
+    {
+        return const_iterator{m_payload.data()};
+    }
+
+    [[nodiscard]] constexpr const_iterator end() const noexcept
+    {
+        return const_iterator{m_payload.data() + m_payload.size()};
+    }
+
+    /**
+     * Raw little-endian payload bytes of the string.
+     */
+    [[nodiscard]] constexpr std::span<const byte> bytes() const noexcept
+    {
+        return m_payload;
+    }
+
+    /**
+     * Copy the viewed characters into \out, reusing its capacity.
+     *
+     * @param out output string to write the characters to.
+     */
+    constexpr void materialize(std::u16string& out) const
+    {
+        out.resize_and_overwrite(size(), [this](char16_t* dst, std::size_t n) noexcept
+        {
+            load_ucs2_le(m_payload.data(), dst, n);
+            return n;
+        });
+    }
+
+    [[nodiscard]] constexpr std::u16string to_u16string() const
+    {
+        std::u16string str;
+        materialize(str);
+        return str;
+    }
+
+    [[nodiscard]] constexpr bool operator==(std::u16string_view str) const noexcept
+    {
+        return std::equal(begin(), end(), str.cbegin(), str.cend());
+    }
+
+private:
+    std::span<const byte> m_payload{};
+};
+
+} // namespace umb
+
+#endif // USCRIPT_MSGBUF_VIEW_HPP
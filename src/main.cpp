@@ -184,6 +184,9 @@ struct MsgAnalysisResult
     // This includes the sizes of all known static fields plus the sizes of all
     // size header fields for dynamic fields. (See: g_dynamic_field_header_size).
     std::size_t static_part{0};
+    // Serialized size of a default constructed message. Floats are
+    // encoded as "0" by default, dynamic fields are empty.
+    std::size_t default_size{0};
     // True if message has static size and is always guaranteed to fit in a single packet.
     bool always_single_part{false};
     // True if message has float fields. Indicates the need for temporary
@@ -206,6 +209,7 @@ std::ostream& operator<<(std::ostream& os, const MsgAnalysisResult& result)
        << ", has_static_size: " << result.has_static_size
        << ", static_size: " << result.static_size
        << ", static_part: " << result.static_part
+       << ", default_size: " << result.default_size
        << ", always_single_part: " << result.always_single_part
        << ", has_float_fields: " << result.has_float_fields
        << ", has_string_fields: " << result.has_string_fields
@@ -287,19 +291,24 @@ MsgAnalysisResult analyze_message(const inja::json& data)
     result.bool_packs.reserve(bool_packs.size());
     result.bool_packs.insert(result.bool_packs.end(), bool_packs.cbegin(), bool_packs.cend());
 
-    const auto max_byte_bp = std::max_element(
-        bool_packs.cbegin(), bool_packs.cend(),
-        [](const BoolPack& first, const BoolPack& second)
-        {
-            return first.byte < second.byte;
-        });
-    std::size_t num_packed_bytes = 0;
-    if (max_byte_bp != bool_packs.cend())
+    // Total size of all bools in the message. Each run of consecutive
+    // bools takes ceil(run / 8) bytes, a lone bool takes a full byte.
+    std::size_t total_pack_size = 0;
+    std::size_t run = 0;
+    for (const auto& field: fields)
     {
-        // Byte refers to index here, add 1 to get total amount of them.
-        num_packed_bytes = max_byte_bp->byte + 1;
+        if (field["type"] == "bool")
+        {
+            ++run;
+        }
+        else
+        {
+            total_pack_size += (run + ::umb::g_bools_in_byte - 1) / ::umb::g_bools_in_byte;
+            run = 0;
+        }
     }
-    const auto total_pack_size = num_packed_bytes * ::umb::g_sizeof_byte;
+    total_pack_size += (run + ::umb::g_bools_in_byte - 1) / ::umb::g_bools_in_byte;
+    total_pack_size *= ::umb::g_sizeof_byte;
 
     std::vector<std::string> types;
     types.reserve(fields.size());
@@ -332,7 +341,8 @@ MsgAnalysisResult analyze_message(const inja::json& data)
         result.static_part = static_size;
         for (const auto& type: types)
         {
-            if (in_vector(::umb::g_dynamic_types, type))
+            // Floats are also prefixed with a size header.
+            if (in_vector(::umb::g_dynamic_types, type) || type == "float")
             {
                 result.static_part += ::umb::g_dynamic_field_header_size;
             }
@@ -349,6 +359,16 @@ MsgAnalysisResult analyze_message(const inja::json& data)
         return type == "float";
     });
 
+    if (result.has_static_size)
+    {
+        result.default_size = result.static_size;
+    }
+    else
+    {
+        const auto num_floats = std::count(types.cbegin(), types.cend(), "float");
+        result.default_size = result.static_part + static_cast<std::size_t>(num_floats);
+    }
+
     result.has_string_fields = std::any_of(types.cbegin(), types.cend(), [](const std::string& type)
     {
         return type == "string";
@@ -451,18 +471,46 @@ constexpr auto error = [](const inja::Arguments& args)
     throw std::invalid_argument(ss.str());
 };
 
-constexpr auto cpp_type = [](const inja::Arguments& args) constexpr
+// C++ type of a message field (arg 0). Takes the whole field object,
+// since string and bytes fields may use inline storage.
+constexpr auto cpp_type = [](const inja::Arguments& args) MAYBE_CONSTEXPR
 {
-    const auto& type = args.at(0)->get<std::string>();
+    const auto& field = args.at(0)->get<inja::json>();
+    const auto& type = field["type"].get<std::string>();
+    if (field.value("cpp_inline_storage", false))
+    {
+        return std::format("{}<{}>", ::umb::g_type_to_cpp_inline_type.at(type),
+                           field["max_size"].get<std::size_t>());
+    }
+    if (field.value("cpp_pmr", false))
+    {
+        return ::umb::g_type_to_cpp_pmr_type.at(type);
+    }
     return ::umb::g_type_to_cpp_type.at(type);
 };
 
-constexpr auto cpp_type_arg = [](const inja::Arguments& args) constexpr
+// C++ setter argument type of a message field (arg 0).
+constexpr auto cpp_type_arg = [](const inja::Arguments& args) MAYBE_CONSTEXPR
 {
-    const auto& type = args.at(0)->get<std::string>();
+    const auto& field = args.at(0)->get<inja::json>();
+    const auto& type = field["type"].get<std::string>();
+    if (field.value("cpp_inline_storage", false))
+    {
+        return ::umb::g_type_to_cpp_inline_type_arg.at(type);
+    }
+    if (field.value("cpp_pmr", false))
+    {
+        return ::umb::g_type_to_cpp_pmr_type_arg.at(type);
+    }
     return ::umb::g_type_to_cpp_type_arg.at(type);
 };
 
+constexpr auto cpp_view_type = [](const inja::Arguments& args) constexpr
+{
+    const auto& type = args.at(0)->get<std::string>();
+    return ::umb::g_type_to_cpp_view_type.at(type);
+};
+
 constexpr auto cpp_default_value = [](const inja::Arguments& args) constexpr
 {
     const auto& type = args.at(0)->get<std::string>();
@@ -525,6 +573,33 @@ constexpr auto bp_is_multi_pack_boundary = [](const inja::Arguments& args) MAYBE
     return bp_get<bool>(bps, name, "boundary");
 };
 
+// Size in bytes of the bool pack starting at the named bool.
+constexpr auto bp_pack_bytes = [](const inja::Arguments& args) MAYBE_CONSTEXPR
+{
+    const auto& bps = args.at(0)->get<std::vector<inja::json>>();
+    const auto& name = args.at(1)->get<std::string>();
+
+    auto it = std::find_if(bps.cbegin(), bps.cend(), [&name](const inja::json& bp)
+    {
+        return name == bp["field_name"].get<std::string>();
+    });
+    if (it == bps.cend())
+    {
+        throw std::invalid_argument(std::format("cannot find pack of '{}'", name));
+    }
+
+    std::size_t num_bools = 0;
+    for (; it != bps.cend(); ++it)
+    {
+        ++num_bools;
+        if ((*it)["last"].get<bool>())
+        {
+            break;
+        }
+    }
+    return (num_bools + ::umb::g_bools_in_byte - 1) / ::umb::g_bools_in_byte;
+};
+
 // TODO: don't call this from Inja if not generating meta code?
 constexpr auto meta_field_type = [](const inja::Arguments& args) constexpr
 {
@@ -664,12 +739,14 @@ render(
     env.add_callback("var_int", var_int);
     env.add_callback("cpp_type", 1, cpp_type);
     env.add_callback("cpp_type_arg", 1, cpp_type_arg);
+    env.add_callback("cpp_view_type", 1, cpp_view_type);
     env.add_callback("cpp_default_value", 1, cpp_default_value);
     env.add_callback("uscript_type", 1, uscript_type);
     env.add_callback("bp_is_packed", 2, bp_is_packed);
     env.add_callback("bp_pack_index", 2, bp_pack_index);
     env.add_callback("bp_is_last", 2, bp_is_last);
     env.add_callback("bp_is_multi_pack_boundary", 2, bp_is_multi_pack_boundary);
+    env.add_callback("bp_pack_bytes", 2, bp_pack_bytes);
     env.add_callback("meta_field_type", 1, meta_field_type);
     env.add_void_callback("error", error);
 
@@ -680,14 +757,58 @@ render(
 
     auto& messages = data["messages"];
 
+    // Inline storage can be enabled for the whole file and
+    // overridden for individual string and bytes fields.
+    const bool inline_storage = data.value("cpp_inline_storage", false);
+    // Heap backed string and bytes fields use std::pmr containers and
+    // message constructors take a std::pmr::memory_resource.
+    const bool pmr = data.value("cpp_pmr", false);
+    data["cpp_pmr"] = pmr;
+
     for (auto& message: messages)
     {
+        bool has_bounded_inline_fields = false;
+        bool has_pmr_fields = false;
+        for (auto& field: message["fields"])
+        {
+            const auto& type = field["type"].get<std::string>();
+            if (!in_vector(::umb::g_dynamic_types, type))
+            {
+                // Templates check these for every field.
+                field["cpp_inline_storage"] = false;
+                field["cpp_pmr"] = false;
+                continue;
+            }
+
+            const std::size_t max_size = field.value("max_size", ::umb::g_max_dynamic_size);
+            if (max_size == 0 || max_size > ::umb::g_max_dynamic_size)
+            {
+                throw std::invalid_argument(std::format(
+                    "invalid max_size {} for '{}' in {}, must be in range [1, {}]",
+                    max_size, field["name"].get<std::string>(),
+                    message["name"].get<std::string>(), ::umb::g_max_dynamic_size));
+            }
+            field["max_size"] = max_size;
+
+            const bool field_inline = field.value("cpp_inline_storage", inline_storage);
+            field["cpp_inline_storage"] = field_inline;
+            field["cpp_pmr"] = pmr && !field_inline;
+            has_pmr_fields = has_pmr_fields || (pmr && !field_inline);
+            if (field_inline && max_size < ::umb::g_max_dynamic_size)
+            {
+                has_bounded_inline_fields = true;
+            }
+        }
+        message["has_bounded_inline_fields"] = has_bounded_inline_fields;
+        message["has_pmr_fields"] = has_pmr_fields;
+
         auto result = analyze_message(message);
         std::cout << result << "\n";
         message["has_static_size"] = result.has_static_size;
         message["always_single_part"] = result.always_single_part;
         message["static_size"] = result.static_size;
         message["static_part"] = result.static_part;
+        message["default_size"] = result.default_size;
         message["has_float_fields"] = result.has_float_fields;
         message["has_string_fields"] = result.has_string_fields;
         message["has_bytes_fields"] = result.has_bytes_fields;
@@ -0,0 +1,1617 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <sstream>
+#include <stop_token>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+
+#include "umb/umb.hpp"
+#include "umb/net/connection.hpp"
+#include "umb/net/server.hpp"
+#include "umb/net/uring_server.hpp"
+#include "umb/trace.hpp"
+
+#include "InlineMessages.umb.hpp"
+#include "PmrMessages.umb.hpp"
+#include "TestMessages.umb.hpp"
+
+namespace
+{
+
+constexpr std::size_t g_traffic_packets = 1024;
+
+// Build a packet mix where roughly fail_percent of the packets
+// are truncated or contain a malformed float.
+std::vector<std::vector<::umb::byte>> make_float_traffic(int64_t fail_percent)
+{
+    testmessages::umb::JustAnotherTestMessage msg;
+    std::vector<std::vector<::umb::byte>> packets;
+    packets.reserve(g_traffic_packets);
+
+    for (std::size_t i = 0; i < g_traffic_packets; ++i)
+    {
+        msg.set_some_floatVAR(static_cast<float>(i) * 1.25F);
+        msg.set_ByteVarX(static_cast<::umb::byte>(i));
+        auto bytes = msg.to_bytes();
+
+        const auto roll = static_cast<int64_t>((i * 37) % 100);
+        if (roll < fail_percent)
+        {
+            if (i % 2 == 0)
+            {
+                // Truncated packet.
+                bytes.resize(bytes.size() / 2);
+            }
+            else
+            {
+                // Malformed float string.
+                bytes[::umb::g_header_size + 1] = 'x';
+            }
+        }
+
+        packets.emplace_back(std::move(bytes));
+    }
+
+    return packets;
+}
+
+// Mirrors the exception based from_bytes that was generated
+// for JustAnotherTestMessage before try_from_bytes existed.
+bool legacy_from_bytes(
+    const std::span<const ::umb::byte> bytes,
+    float& some_float,
+    ::umb::byte& byte_var)
+{
+    try
+    {
+        auto vi = bytes.cbegin();
+        if (!::umb::check_bounds_no_throw(vi, bytes, ::umb::g_header_size))
+        {
+            return false;
+        }
+        std::advance(vi, ::umb::g_header_size);
+        ::umb::decode_float(vi, bytes, some_float);
+        ::umb::decode_byte(vi, bytes, byte_var);
+        return true;
+    }
+    catch (const std::out_of_range&)
+    {
+        return false;
+    }
+    // The old generated code did not catch this, but the
+    // benchmark has to survive malformed floats.
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+}
+
+void BM_DecodeFailureHeavy_Exceptions(benchmark::State& state)
+{
+    const auto packets = make_float_traffic(state.range(0));
+    float f = 0;
+    ::umb::byte b = 0;
+    int64_t ok = 0;
+
+    for (auto _: state)
+    {
+        for (const auto& packet: packets)
+        {
+            ok += legacy_from_bytes(packet, f, b);
+        }
+        benchmark::DoNotOptimize(ok);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(packets.size()));
+}
+
+void BM_DecodeFailureHeavy_Expected(benchmark::State& state)
+{
+    const auto packets = make_float_traffic(state.range(0));
+    testmessages::umb::JustAnotherTestMessage msg;
+    int64_t ok = 0;
+
+    for (auto _: state)
+    {
+        for (const auto& packet: packets)
+        {
+            ok += msg.try_from_bytes(packet).has_value();
+        }
+        benchmark::DoNotOptimize(ok);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(packets.size()));
+}
+
+std::vector<::umb::byte> make_static_packet()
+{
+    testmessages::umb::STATIC_BoolPackingMessage msg;
+    msg.set_pack1(true);
+    msg.set_int_pack_delimiter(69);
+    msg.set_some_byte_delimiter(0x7f);
+    msg.set_bool_10_part_pack__9(true);
+    msg.set_int_after_long_pack(-12345);
+    return msg.to_bytes();
+}
+
+// Mirrors the per-field bounds checked from_bytes that was
+// generated for STATIC_BoolPackingMessage before validate_size.
+struct StaticBoolPackingFields
+{
+    bool b[17];
+    int32_t i[3];
+    ::umb::byte byte;
+};
+
+bool per_field_from_bytes(const std::span<const ::umb::byte> bytes, StaticBoolPackingFields& f)
+{
+    auto vi = bytes.cbegin();
+    if (!::umb::check_bounds_no_throw(vi, bytes, ::umb::g_header_size))
+    {
+        return false;
+    }
+    std::advance(vi, ::umb::g_header_size);
+    return ::umb::try_decode_packed_bools(vi, bytes, f.b[0], f.b[1], f.b[2], f.b[3])
+           && ::umb::try_decode_int32(vi, bytes, f.i[0])
+           && ::umb::try_decode_bool(vi, bytes, f.b[4])
+           && ::umb::try_decode_byte(vi, bytes, f.byte)
+           && ::umb::try_decode_int32(vi, bytes, f.i[1])
+           && ::umb::try_decode_packed_bools(vi, bytes, f.b[5], f.b[6], f.b[7], f.b[8], f.b[9],
+                                             f.b[10], f.b[11], f.b[12], f.b[13], f.b[14])
+           && ::umb::try_decode_int32(vi, bytes, f.i[2])
+           && ::umb::try_decode_packed_bools(vi, bytes, f.b[15], f.b[16]);
+}
+
+void BM_DecodeStatic_PerFieldChecks(benchmark::State& state)
+{
+    const auto packet = make_static_packet();
+    StaticBoolPackingFields fields{};
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(per_field_from_bytes(packet, fields));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_DecodeStatic_ValidateOnce(benchmark::State& state)
+{
+    const auto packet = make_static_packet();
+    testmessages::umb::STATIC_BoolPackingMessage msg;
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(msg.from_bytes(packet));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Byte at a time int32 codec, as used by coding.hpp before load_le/store_le.
+int32_t bytewise_load_int32(const ::umb::byte* p)
+{
+    return static_cast<int32_t>(p[0])
+           | static_cast<int32_t>(p[1]) << 8
+           | static_cast<int32_t>(p[2]) << 16
+           | static_cast<int32_t>(p[3]) << 24;
+}
+
+void bytewise_store_int32(int32_t i, ::umb::byte* p)
+{
+    p[0] = i & 0xff;
+    p[1] = (i >> 8) & 0xff;
+    p[2] = (i >> 16) & 0xff;
+    p[3] = (i >> 24) & 0xff;
+}
+
+std::vector<testmessages::umb::GetSomeStuffResp> make_int_messages()
+{
+    std::vector<testmessages::umb::GetSomeStuffResp> msgs(g_traffic_packets);
+    for (std::size_t i = 0; i < msgs.size(); ++i)
+    {
+        msgs[i].set_session(static_cast<int32_t>(i * 2654435761U));
+        msgs[i].set_userid(-static_cast<int32_t>(i));
+    }
+    return msgs;
+}
+
+void BM_IntRoundTrip_Bytewise(benchmark::State& state)
+{
+    const auto msgs = make_int_messages();
+    std::vector<::umb::byte> buf(msgs.size() * msgs[0].serialized_size());
+    int64_t sum = 0;
+
+    for (auto _: state)
+    {
+        auto* p = buf.data();
+        for (const auto& msg: msgs)
+        {
+            p[0] = static_cast<::umb::byte>(msg.serialized_size());
+            p[1] = ::umb::g_part_single_part;
+            p[2] = static_cast<uint16_t>(msg.type()) & 0xff;
+            p[3] = (static_cast<uint16_t>(msg.type()) >> 8) & 0xff;
+            bytewise_store_int32(msg.session(), p + 4);
+            bytewise_store_int32(msg.userid(), p + 8);
+            p += msg.serialized_size();
+        }
+        p = buf.data();
+        for (std::size_t i = 0; i < msgs.size(); ++i)
+        {
+            sum += bytewise_load_int32(p + 4) + bytewise_load_int32(p + 8);
+            p += msgs[i].serialized_size();
+        }
+        benchmark::DoNotOptimize(sum);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(msgs.size()));
+}
+
+void BM_IntRoundTrip_WordAtATime(benchmark::State& state)
+{
+    const auto msgs = make_int_messages();
+    std::vector<::umb::byte> buf(msgs.size() * msgs[0].serialized_size());
+    int64_t sum = 0;
+
+    for (auto _: state)
+    {
+        auto wi = std::span{buf}.begin();
+        for (const auto& msg: msgs)
+        {
+            ::umb::encode_header(static_cast<::umb::byte>(msg.serialized_size()),
+                                 ::umb::g_part_single_part,
+                                 static_cast<uint16_t>(msg.type()), wi);
+            ::umb::encode_int32(msg.session(), wi);
+            ::umb::encode_int32(msg.userid(), wi);
+        }
+        auto ri = std::span<const ::umb::byte>{buf}.cbegin();
+        for (std::size_t i = 0; i < msgs.size(); ++i)
+        {
+            int32_t session = 0;
+            int32_t userid = 0;
+            std::advance(ri, ::umb::g_header_size);
+            ::umb::decode_int32_unchecked(ri, session);
+            ::umb::decode_int32_unchecked(ri, userid);
+            sum += session + userid;
+        }
+        benchmark::DoNotOptimize(sum);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(msgs.size()));
+}
+
+// Full generated to_bytes / from_bytes round trip.
+void BM_IntRoundTrip_Generated(benchmark::State& state)
+{
+    const auto msgs = make_int_messages();
+    std::vector<::umb::byte> buf(msgs.size() * msgs[0].serialized_size());
+    testmessages::umb::GetSomeStuffResp out;
+    int64_t sum = 0;
+
+    for (auto _: state)
+    {
+        auto span = std::span{buf};
+        for (const auto& msg: msgs)
+        {
+            benchmark::DoNotOptimize(msg.to_bytes(span));
+            span = span.subspan(msg.serialized_size());
+        }
+        std::span<const ::umb::byte> in{buf};
+        for (std::size_t i = 0; i < msgs.size(); ++i)
+        {
+            const auto size = msgs[i].serialized_size();
+            benchmark::DoNotOptimize(out.from_bytes(in.first(size)));
+            sum += out.session() + out.userid();
+            in = in.subspan(size);
+        }
+        benchmark::DoNotOptimize(sum);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(msgs.size()));
+}
+
+// One send buffer per message, as returned by to_bytes().
+void BM_EncodeBatch_ToBytes(benchmark::State& state)
+{
+    const auto msgs = make_int_messages();
+    std::size_t total = 0;
+
+    for (auto _: state)
+    {
+        for (const auto& msg: msgs)
+        {
+            const auto bytes = msg.to_bytes();
+            total += bytes.size();
+            benchmark::DoNotOptimize(bytes.data());
+        }
+        benchmark::ClobberMemory();
+    }
+
+    benchmark::DoNotOptimize(total);
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(msgs.size()));
+}
+
+// All messages appended to a single reused send buffer.
+void BM_EncodeBatch_Append(benchmark::State& state)
+{
+    const auto msgs = make_int_messages();
+    std::vector<::umb::byte> buffer;
+
+    for (auto _: state)
+    {
+        buffer.clear();
+        for (const auto& msg: msgs)
+        {
+            msg.encode_append(buffer);
+        }
+        benchmark::DoNotOptimize(buffer.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(msgs.size()));
+}
+
+testmessages::umb::testmsg make_multipart_message()
+{
+    testmessages::umb::testmsg msg;
+    msg.set_ffffff(std::u16string(250, u'x'));
+    msg.set_a_field_with_some_bytes_that_do_some_things(std::vector<::umb::byte>(250, 0xab));
+    return msg;
+}
+
+// Split after encoding through a single packet send buffer, as
+// the echo server did before to_packets.
+void BM_Multipart_CopyToSendBuf(benchmark::State& state)
+{
+    const auto msg = make_multipart_message();
+    std::array<::umb::byte, ::umb::g_packet_size> send_buf{};
+
+    for (auto _: state)
+    {
+        const auto bytes = msg.to_bytes();
+        const auto count = ::umb::packet_count(bytes.size());
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const auto offset = ::umb::g_header_size + i * ::umb::g_payload_size;
+            const auto n = std::min(::umb::g_payload_size, bytes.size() - offset);
+            send_buf[0] = static_cast<::umb::byte>(n + ::umb::g_header_size);
+            send_buf[1] = ::umb::packet_part(i, count);
+            send_buf[2] = bytes[2];
+            send_buf[3] = bytes[3];
+            std::copy_n(bytes.cbegin() + static_cast<std::ptrdiff_t>(offset), n,
+                        send_buf.begin() + ::umb::g_header_size);
+            benchmark::DoNotOptimize(send_buf.data());
+            benchmark::ClobberMemory();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Multipart_ToPackets(benchmark::State& state)
+{
+    const auto msg = make_multipart_message();
+    std::vector<::umb::byte> buffer;
+
+    for (auto _: state)
+    {
+        buffer.clear();
+        msg.to_packets(buffer);
+        benchmark::DoNotOptimize(buffer.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Multipart_ScatterGather(benchmark::State& state)
+{
+    const auto msg = make_multipart_message();
+    std::vector<::umb::byte> buffer;
+    ::umb::PacketFrames frames;
+
+    for (auto _: state)
+    {
+        buffer.clear();
+        msg.encode_append(buffer);
+        benchmark::DoNotOptimize(frames.frame(buffer).data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+std::vector<std::span<const ::umb::byte>> split_packets(std::span<const ::umb::byte> packets)
+{
+    std::vector<std::span<const ::umb::byte>> parts;
+    for (; !packets.empty(); packets = packets.subspan(packets[0]))
+    {
+        parts.push_back(packets.first(packets[0]));
+    }
+    return parts;
+}
+
+// Copy every part's payload into one buffer, then decode it.
+void BM_MultipartDecode_Reassemble(benchmark::State& state)
+{
+    std::vector<::umb::byte> packets;
+    make_multipart_message().to_packets(packets);
+    const auto parts = split_packets(packets);
+    std::vector<::umb::byte> msg_buf;
+    testmessages::umb::testmsg msg;
+
+    for (auto _: state)
+    {
+        msg_buf.clear();
+        msg_buf.insert(msg_buf.end(), parts[0].begin(), parts[0].end());
+        for (std::size_t i = 1; i < parts.size(); ++i)
+        {
+            msg_buf.insert(msg_buf.end(), parts[i].begin() + ::umb::g_header_size, parts[i].end());
+        }
+        benchmark::DoNotOptimize(msg.from_bytes(msg_buf));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(packets.size()));
+}
+
+void BM_MultipartDecode_Parts(benchmark::State& state)
+{
+    std::vector<::umb::byte> packets;
+    make_multipart_message().to_packets(packets);
+    const auto parts = split_packets(packets);
+    testmessages::umb::testmsg msg;
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(msg.try_from_parts(parts));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(packets.size()));
+}
+
+// Parse a stream of small packets pushed in chunks of range(0) bytes.
+void BM_StreamParser_Push(benchmark::State& state)
+{
+    std::vector<::umb::byte> stream;
+    for (const auto& msg: make_int_messages())
+    {
+        msg.encode_append(stream);
+    }
+    const auto chunk_size = static_cast<std::size_t>(state.range(0));
+    ::umb::StreamParser parser;
+    int64_t sum = 0;
+
+    for (auto _: state)
+    {
+        for (auto in = std::span<const ::umb::byte>{stream}; !in.empty();)
+        {
+            const auto chunk = in.first(std::min(chunk_size, in.size()));
+            in = in.subspan(chunk.size());
+            benchmark::DoNotOptimize(parser.push(chunk, [&sum](const ::umb::StreamMessage& msg)
+            {
+                sum += msg.type;
+            }));
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(g_traffic_packets));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(stream.size()));
+}
+
+// Loopback TCP connection whose peer thread keeps sending \stream.
+class LoopbackSender
+{
+public:
+    explicit LoopbackSender(std::vector<::umb::byte> stream)
+        : m_stream(std::move(stream)),
+          m_acceptor(m_io, {boost::asio::ip::address_v4::loopback(), 0}),
+          m_socket(m_io)
+    {
+        boost::asio::ip::tcp::socket peer(m_io);
+        peer.connect(m_acceptor.local_endpoint());
+        m_acceptor.accept(m_socket);
+        m_sender = std::jthread([this, peer = std::move(peer)](const std::stop_token& stop) mutable
+        {
+            boost::system::error_code ec;
+            while (!stop.stop_requested() && !ec)
+            {
+                boost::asio::write(peer, boost::asio::buffer(m_stream), ec);
+            }
+        });
+    }
+
+    ~LoopbackSender()
+    {
+        m_sender.request_stop();
+        // Fails the peer's blocking write.
+        m_socket.close();
+    }
+
+    [[nodiscard]] boost::asio::ip::tcp::socket& socket() noexcept
+    {
+        return m_socket;
+    }
+
+private:
+    std::vector<::umb::byte> m_stream;
+    boost::asio::io_context m_io;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::ip::tcp::socket m_socket;
+    std::jthread m_sender;
+};
+
+std::vector<::umb::byte> make_small_packet_stream()
+{
+    std::vector<::umb::byte> stream;
+    for (std::size_t i = 0; i < g_traffic_packets; ++i)
+    {
+        testmessages::umb::GetSomeStuff msg;
+        msg.set_session(static_cast<int32_t>(i));
+        msg.encode_append(stream);
+    }
+    return stream;
+}
+
+// Header and payload read separately for every packet,
+// as the echo server did before batched reads.
+void BM_SocketRead_HeaderThenPayload(benchmark::State& state)
+{
+    LoopbackSender sender{make_small_packet_stream()};
+    auto& socket = sender.socket();
+    std::array<::umb::byte, ::umb::g_packet_size> data{};
+    testmessages::umb::GetSomeStuff msg;
+
+    for (auto _: state)
+    {
+        for (std::size_t i = 0; i < g_traffic_packets; ++i)
+        {
+            boost::asio::read(socket, boost::asio::buffer(data, ::umb::g_header_size));
+            const auto size = data[0];
+            boost::asio::read(
+                socket,
+                boost::asio::buffer(data.data() + ::umb::g_header_size, size - ::umb::g_header_size));
+            benchmark::DoNotOptimize(msg.from_bytes(std::span{data}.first(size)));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(g_traffic_packets));
+}
+
+// Read as much as the socket has, then parse every complete packet.
+void BM_SocketRead_Batched(benchmark::State& state)
+{
+    LoopbackSender sender{make_small_packet_stream()};
+    auto& socket = sender.socket();
+    std::vector<::umb::byte> recv_buf(64 * 1024);
+    ::umb::StreamParser parser;
+    testmessages::umb::GetSomeStuff msg;
+    std::size_t num_reads = 0;
+
+    for (auto _: state)
+    {
+        std::size_t received = 0;
+        while (received < g_traffic_packets)
+        {
+            const auto n = socket.read_some(boost::asio::buffer(recv_buf));
+            ++num_reads;
+            const auto result = parser.push(std::span{recv_buf}.first(n), [&](const ::umb::StreamMessage& sm)
+            {
+                benchmark::DoNotOptimize(msg.from_bytes(sm.parts.front()));
+                ++received;
+            });
+            if (!result)
+            {
+                state.SkipWithError("stream error");
+                return;
+            }
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(g_traffic_packets));
+    state.counters["packets_per_read"] = static_cast<double>(state.iterations() * g_traffic_packets)
+                                         / static_cast<double>(num_reads);
+}
+
+// Mirrors encode_float before it wrote the shortest
+// round-trip string into an inline FloatString.
+void legacy_encode_float(float f, std::string& out)
+{
+    std::string str;
+    constexpr auto pre = std::numeric_limits<float>::max_digits10;
+    constexpr auto longest_float = std::numeric_limits<float>::digits
+                                   - std::numeric_limits<float>::min_exponent;
+    constexpr auto max_str = longest_float + 8;
+    str.resize(max_str);
+    constexpr auto fmt = std::chars_format::scientific;
+    std::to_chars(str.data(), str.data() + str.size(), f, fmt, pre);
+    str.erase(str.find('\0'));
+    out = std::move(str);
+}
+
+std::vector<float> make_positions()
+{
+    std::vector<float> floats(g_traffic_packets);
+    for (std::size_t i = 0; i < floats.size(); ++i)
+    {
+        floats[i] = (static_cast<float>(i) - 512.0F) * 31.337F;
+    }
+    return floats;
+}
+
+void BM_EncodeFloat_Scientific(benchmark::State& state)
+{
+    const auto floats = make_positions();
+    std::string out;
+    std::size_t wire_bytes = 0;
+
+    for (auto _: state)
+    {
+        for (const auto f: floats)
+        {
+            legacy_encode_float(f, out);
+            wire_bytes += out.size();
+        }
+        benchmark::DoNotOptimize(wire_bytes);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(floats.size()));
+    state.counters["wire_bytes_per_float"] = static_cast<double>(wire_bytes)
+                                             / static_cast<double>(state.iterations() * floats.size());
+}
+
+void BM_EncodeFloat_Shortest(benchmark::State& state)
+{
+    const auto floats = make_positions();
+    ::umb::FloatString out;
+    std::size_t wire_bytes = 0;
+
+    for (auto _: state)
+    {
+        for (const auto f: floats)
+        {
+            ::umb::encode_float(f, out);
+            wire_bytes += out.size();
+        }
+        benchmark::DoNotOptimize(wire_bytes);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(floats.size()));
+    state.counters["wire_bytes_per_float"] = static_cast<double>(wire_bytes)
+                                             / static_cast<double>(state.iterations() * floats.size());
+}
+
+// Simulation style updates: every float is set range(0) times per
+// frame before a single encode. Floats are only serialized once.
+void BM_SetFloatsThenEncode(benchmark::State& state)
+{
+    const auto floats = make_positions();
+    const auto sets_per_frame = static_cast<std::size_t>(state.range(0));
+    testmessages::umb::testmsg msg;
+    std::array<::umb::byte, ::umb::g_packet_size> buf{};
+    std::size_t fi = 0;
+
+    for (auto _: state)
+    {
+        for (std::size_t i = 0; i < sets_per_frame; ++i)
+        {
+            const auto f = floats[fi];
+            fi = (fi + 1) % floats.size();
+            msg.set_one(f);
+            msg.set_asd(f * 0.5F);
+            msg.set_fasd(-f);
+        }
+        benchmark::DoNotOptimize(msg.to_bytes(buf));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_DecodeFloatHeavy(benchmark::State& state)
+{
+    testmessages::umb::testmsg in;
+    in.set_one(1.0F);
+    in.set_asd(-35848.9858405F);
+    in.set_fasd(0.00583885F);
+    in.set_sdf(123.456F);
+    in.set_dger(-1.5e-20F);
+    in.set_dfgdf3(std::numeric_limits<float>::max());
+    in.set_vbnvbn3(-0.1F);
+    in.set_sdfg345(42.0F);
+    in.set_nnnffgg(9999.99F);
+    in.set_adssdassdaads(-7.25F);
+    in.set_dyhrthrs556t(3.14159265F);
+    in.set_nfghmfghj3452345(2.71828F);
+    const auto packet = in.to_bytes();
+    testmessages::umb::testmsg out;
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(out.from_bytes(packet));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Read a single field after the dynamic fields: full decode vs view.
+void BM_ReadOneField_Decode(benchmark::State& state)
+{
+    testmessages::umb::BoolPackingMessage in;
+    in.set_float_delimiter_asd(-0.25F);
+    in.set_int_after_long_pack(42);
+    in.set_end_msg_with_some_dynamic_stuff(u"some dynamic stuff at the end");
+    const auto packet = in.to_bytes();
+    testmessages::umb::BoolPackingMessage out;
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(out.from_bytes(packet));
+        benchmark::DoNotOptimize(out.int_after_long_pack());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ReadOneField_View(benchmark::State& state)
+{
+    testmessages::umb::BoolPackingMessage in;
+    in.set_float_delimiter_asd(-0.25F);
+    in.set_int_after_long_pack(42);
+    in.set_end_msg_with_some_dynamic_stuff(u"some dynamic stuff at the end");
+    const auto packet = in.to_bytes();
+
+    for (auto _: state)
+    {
+        const auto view = testmessages::umb::BoolPackingMessageView::try_from_bytes(packet);
+        benchmark::DoNotOptimize(view->int_after_long_pack());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Fill any message with string fields a, b and c.
+template<typename MultiStringMessage>
+void set_chat_message(MultiStringMessage& msg)
+{
+    msg.set_a(u"PlayerName_With_Clan_Tag");
+    msg.set_b(u"gg wp, that last round was close. rematch on the next map?");
+    msg.set_c(std::u16string(80, u'\u00e4'));
+}
+
+std::vector<::umb::byte> make_chat_packet()
+{
+    testmessages::umb::MultiStringMessage msg;
+    set_chat_message(msg);
+    return msg.to_bytes();
+}
+
+// Heap memory owned by \str, zero if the characters are stored inline.
+std::size_t heap_bytes(const std::u16string& str)
+{
+    const auto* p = reinterpret_cast<const char*>(str.data());
+    const auto* obj = reinterpret_cast<const char*>(&str);
+    if (p >= obj && p < obj + sizeof(str))
+    {
+        return 0;
+    }
+    return (str.capacity() + 1) * sizeof(char16_t);
+}
+
+// Byte at a time string decode, as used by coding.hpp before load_ucs2_le.
+void bytewise_decode_string(std::span<const ::umb::byte>::const_iterator& i, std::u16string& out)
+{
+    const ::umb::byte str_size = *i++;
+    out.resize(str_size);
+    for (auto& c: out)
+    {
+        c = static_cast<char16_t>(i[0] | (i[1] << 8));
+        std::advance(i, ::umb::g_sizeof_uscript_char);
+    }
+}
+
+void BM_DecodeStrings_Bytewise(benchmark::State& state)
+{
+    const auto packet = make_chat_packet();
+    std::u16string a;
+    std::u16string b;
+    std::u16string c;
+
+    for (auto _: state)
+    {
+        auto i = std::span<const ::umb::byte>{packet}.cbegin();
+        std::advance(i, ::umb::g_header_size);
+        bytewise_decode_string(i, a);
+        bytewise_decode_string(i, b);
+        bytewise_decode_string(i, c);
+        benchmark::DoNotOptimize(a.data());
+        benchmark::DoNotOptimize(b.data());
+        benchmark::DoNotOptimize(c.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(packet.size()));
+}
+
+void BM_DecodeStrings_Generated(benchmark::State& state)
+{
+    const auto packet = make_chat_packet();
+    testmessages::umb::MultiStringMessage msg;
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(msg.from_bytes(packet));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(packet.size()));
+    state.counters["object_bytes"] = sizeof(msg);
+    state.counters["heap_bytes"] = static_cast<double>(
+        heap_bytes(msg.a()) + heap_bytes(msg.b()) + heap_bytes(msg.c()));
+}
+
+void BM_EncodeStrings_Generated(benchmark::State& state)
+{
+    testmessages::umb::MultiStringMessage msg;
+    set_chat_message(msg);
+    std::vector<::umb::byte> buf(msg.serialized_size());
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(msg.to_bytes(buf));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buf.size()));
+}
+
+void BM_DecodeStrings_Inline(benchmark::State& state)
+{
+    const auto packet = make_chat_packet();
+    inlinemessages::InlineMultiStringMessage msg;
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(msg.from_bytes(packet));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(packet.size()));
+    state.counters["object_bytes"] = sizeof(msg);
+    state.counters["heap_bytes"] = 0;
+}
+
+void BM_EncodeStrings_Inline(benchmark::State& state)
+{
+    inlinemessages::InlineMultiStringMessage msg;
+    set_chat_message(msg);
+    std::vector<::umb::byte> buf(msg.serialized_size());
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(msg.to_bytes(buf));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buf.size()));
+}
+
+constexpr std::size_t g_batch_size = 256;
+
+std::vector<::umb::byte> make_pmr_chat_packet()
+{
+    pmrmessages::PmrChatMessage msg;
+    msg.set_sender(7);
+    set_chat_message(msg);
+    msg.set_attachment(std::vector<::umb::byte>(40, 0xab));
+    return msg.to_bytes();
+}
+
+// Decode a batch of messages per tick, then discard them all.
+void BM_DecodeBatch_DefaultAllocator(benchmark::State& state)
+{
+    const auto packet = make_pmr_chat_packet();
+    std::vector<std::unique_ptr<pmrmessages::PmrChatMessage>> batch;
+    batch.reserve(g_batch_size);
+
+    for (auto _: state)
+    {
+        for (std::size_t i = 0; i < g_batch_size; ++i)
+        {
+            auto& msg = batch.emplace_back(std::make_unique<pmrmessages::PmrChatMessage>());
+            benchmark::DoNotOptimize(msg->from_bytes(packet));
+        }
+        batch.clear();
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(g_batch_size));
+}
+
+void BM_DecodeBatch_MonotonicArena(benchmark::State& state)
+{
+    const auto packet = make_pmr_chat_packet();
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::polymorphic_allocator<pmrmessages::PmrChatMessage> alloc{&arena};
+    std::vector<pmrmessages::PmrChatMessage*> batch;
+    batch.reserve(g_batch_size);
+
+    for (auto _: state)
+    {
+        for (std::size_t i = 0; i < g_batch_size; ++i)
+        {
+            auto* msg = batch.emplace_back(alloc.new_object<pmrmessages::PmrChatMessage>(&arena));
+            benchmark::DoNotOptimize(msg->from_bytes(packet));
+        }
+        // Messages only own arena memory, skip the destructors
+        // and release everything at once.
+        batch.clear();
+        arena.release();
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(g_batch_size));
+}
+
+// Decode each received packet into a fresh message, as the echo server used to.
+void BM_DecodePerPacket_MakeShared(benchmark::State& state)
+{
+    const auto packet = make_chat_packet();
+
+    for (auto _: state)
+    {
+        std::shared_ptr<::umb::Message> msg = std::make_shared<testmessages::umb::MultiStringMessage>();
+        benchmark::DoNotOptimize(msg->from_bytes(packet));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_DecodePerPacket_Pooled(benchmark::State& state)
+{
+    const auto packet = make_chat_packet();
+    auto& pool = testmessages::umb::thread_message_pool();
+
+    for (auto _: state)
+    {
+        const auto msg = pool.acquire(testmessages::umb::MessageType::MultiStringMessage);
+        benchmark::DoNotOptimize(msg->from_bytes(packet));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+std::vector<std::vector<::umb::byte>> make_mixed_traffic()
+{
+    testmessages::umb::GetSomeStuffResp gssr;
+    gssr.set_session(1);
+    gssr.set_userid(2);
+    testmessages::umb::DualStringMessage dsm;
+    dsm.set_a(u"first");
+    dsm.set_b(u"second");
+    testmessages::umb::JustAnotherTestMessage jatm;
+    jatm.set_some_floatVAR(1.5F);
+    return {gssr.to_bytes(), dsm.to_bytes(), jatm.to_bytes(), make_chat_packet()};
+}
+
+// Receive loop dispatching with a switch over MessageType to heap allocated messages.
+void BM_Dispatch_SharedPtrSwitch(benchmark::State& state)
+{
+    const auto traffic = make_mixed_traffic();
+    std::array<::umb::byte, ::umb::g_packet_size> out{};
+
+    for (auto _: state)
+    {
+        for (const auto& packet: traffic)
+        {
+            const auto type = static_cast<testmessages::umb::MessageType>(packet[2] | (packet[3] << 8));
+            std::shared_ptr<::umb::Message> msg;
+            switch (type)
+            {
+                case testmessages::umb::MessageType::GetSomeStuffResp:
+                    msg = std::make_shared<testmessages::umb::GetSomeStuffResp>();
+                    break;
+                case testmessages::umb::MessageType::DualStringMessage:
+                    msg = std::make_shared<testmessages::umb::DualStringMessage>();
+                    break;
+                case testmessages::umb::MessageType::JustAnotherTestMessage:
+                    msg = std::make_shared<testmessages::umb::JustAnotherTestMessage>();
+                    break;
+                case testmessages::umb::MessageType::MultiStringMessage:
+                    msg = std::make_shared<testmessages::umb::MultiStringMessage>();
+                    break;
+                default:
+                    state.SkipWithError("unexpected message type");
+                    return;
+            }
+            benchmark::DoNotOptimize(msg->from_bytes(packet));
+            benchmark::DoNotOptimize(msg->to_bytes(out));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(traffic.size()));
+}
+
+void BM_Dispatch_DecodeAny(benchmark::State& state)
+{
+    const auto traffic = make_mixed_traffic();
+    std::array<::umb::byte, ::umb::g_packet_size> out{};
+    testmessages::umb::AnyMessage any;
+
+    for (auto _: state)
+    {
+        for (const auto& packet: traffic)
+        {
+            benchmark::DoNotOptimize(testmessages::umb::decode_any(packet, any));
+            benchmark::DoNotOptimize(testmessages::umb::encode_any(any, out));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(traffic.size()));
+}
+
+// Generated router echoing every message type of the mixed traffic into an outgoing queue.
+void BM_Dispatch_Router(benchmark::State& state)
+{
+    const auto traffic = make_mixed_traffic();
+    std::vector<std::array<std::span<const ::umb::byte>, 1>> parts;
+    for (const auto& packet: traffic)
+    {
+        parts.push_back({packet});
+    }
+
+    const auto echo = [](const auto& msg, ::umb::OutgoingQueue& queue)
+    {
+        queue.push(msg);
+    };
+    testmessages::umb::Router<> router;
+    router.on<testmessages::umb::GetSomeStuffResp>(echo);
+    router.on<testmessages::umb::DualStringMessage>(echo);
+    router.on<testmessages::umb::JustAnotherTestMessage>(echo);
+    router.on<testmessages::umb::MultiStringMessage>(echo);
+    ::umb::OutgoingQueue queue;
+
+    for (auto _: state)
+    {
+        for (std::size_t i = 0; i < traffic.size(); ++i)
+        {
+            const auto& packet = traffic[i];
+            router(::umb::StreamMessage{
+                .type = static_cast<uint16_t>(packet[2] | (packet[3] << 8)),
+                .parts = parts[i],
+            }, queue);
+        }
+        queue.end_batch();
+        benchmark::DoNotOptimize(queue.begin_flush().data());
+        queue.end_flush();
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(traffic.size()));
+}
+
+// Per-packet text logging the echo server used to do: header fields and every byte formatted.
+void BM_TracePacket_Format(benchmark::State& state)
+{
+    const auto traffic = make_mixed_traffic();
+
+    for (auto _: state)
+    {
+        for (const auto& packet: traffic)
+        {
+            std::stringstream ss;
+            ss << std::format("size: {} part: {} type: {} [", +packet[0], +packet[1],
+                              packet[2] | (packet[3] << 8));
+            for (const auto b: packet)
+            {
+                ss << std::format("{},", +b);
+            }
+            ss << "]";
+            benchmark::DoNotOptimize(ss.str());
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(traffic.size()));
+}
+
+// Discards everything written to it.
+class NullBuf: public std::streambuf
+{
+protected:
+    int_type overflow(int_type c) override
+    {
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char_type*, std::streamsize n) override
+    {
+        return n;
+    }
+};
+
+// Binary tracing of every packet with a full snapshot, drained once per iteration.
+void BM_TracePacket_Binary(benchmark::State& state)
+{
+    const auto traffic = make_mixed_traffic();
+    std::vector<std::array<std::span<const ::umb::byte>, 1>> parts;
+    for (const auto& packet: traffic)
+    {
+        parts.push_back({packet});
+    }
+
+    ::umb::Tracer tracer{{.sample_every = 1, .snapshot_bytes = ::umb::g_packet_size}};
+    NullBuf null_buf;
+    std::ostream out(&null_buf);
+
+    for (auto _: state)
+    {
+        for (std::size_t i = 0; i < traffic.size(); ++i)
+        {
+            const auto& packet = traffic[i];
+            tracer.record(1, ::umb::StreamMessage{
+                .type = static_cast<uint16_t>(packet[2] | (packet[3] << 8)),
+                .parts = parts[i],
+            });
+        }
+        benchmark::DoNotOptimize(tracer.drain(out));
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(traffic.size()));
+}
+
+// Loopback TCP connection whose peer thread discards everything it reads.
+class LoopbackSink
+{
+public:
+    LoopbackSink()
+        : m_acceptor(m_io, {boost::asio::ip::address_v4::loopback(), 0}),
+          m_socket(m_io)
+    {
+        boost::asio::ip::tcp::socket peer(m_io);
+        peer.connect(m_acceptor.local_endpoint());
+        m_acceptor.accept(m_socket);
+        m_reader = std::jthread([peer = std::move(peer)]() mutable
+        {
+            std::vector<::umb::byte> buf(64 * 1024);
+            boost::system::error_code ec;
+            while (!ec)
+            {
+                peer.read_some(boost::asio::buffer(buf), ec);
+            }
+        });
+    }
+
+    ~LoopbackSink()
+    {
+        // Ends the peer's blocking read.
+        m_socket.close();
+    }
+
+    [[nodiscard]] boost::asio::ip::tcp::socket& socket() noexcept
+    {
+        return m_socket;
+    }
+
+private:
+    boost::asio::io_context m_io;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::ip::tcp::socket m_socket;
+    std::jthread m_reader;
+};
+
+std::vector<std::unique_ptr<::umb::Message>> make_mixed_replies()
+{
+    auto gssr = std::make_unique<testmessages::umb::GetSomeStuffResp>();
+    gssr->set_session(1);
+    gssr->set_userid(2);
+    auto dsm = std::make_unique<testmessages::umb::DualStringMessage>();
+    dsm->set_a(u"first");
+    dsm->set_b(u"second");
+    auto jatm = std::make_unique<testmessages::umb::JustAnotherTestMessage>();
+    jatm->set_some_floatVAR(1.5F);
+    auto multipart = std::make_unique<testmessages::umb::DualStringMessage>();
+    multipart->set_a(std::u16string(300, u'a'));
+
+    std::vector<std::unique_ptr<::umb::Message>> replies;
+    replies.push_back(std::move(gssr));
+    replies.push_back(std::move(dsm));
+    replies.push_back(std::move(jatm));
+    replies.push_back(std::move(multipart));
+    return replies;
+}
+
+// Queue replies to bursts of 1-16 received messages and write them
+// out according to the flush policy selected by the benchmark argument.
+// Latency is measured from queueing a reply to the end of its write.
+void BM_OutgoingQueue_MixedTraffic(benchmark::State& state)
+{
+    using clock = ::umb::OutgoingQueue::clock;
+    constexpr std::size_t num_batches = 32;
+    const std::array<::umb::FlushPolicy, 3> policies{{
+        {.mode = ::umb::FlushMode::immediate},
+        {.mode = ::umb::FlushMode::end_of_batch},
+        {
+            .mode = ::umb::FlushMode::threshold,
+            .max_bytes = 4 * 1024,
+            .max_delay = std::chrono::microseconds{200},
+        },
+    }};
+
+    LoopbackSink sink;
+    auto& socket = sink.socket();
+    const auto replies = make_mixed_replies();
+    ::umb::OutgoingQueue queue{policies.at(static_cast<std::size_t>(state.range(0)))};
+    std::vector<clock::time_point> queued_at;
+    std::vector<clock::duration> latencies;
+    std::size_t num_messages = 0;
+    std::size_t num_writes = 0;
+    std::size_t num_bytes = 0;
+
+    const auto flush = [&]
+    {
+        const auto bytes = queue.begin_flush();
+        boost::asio::write(socket, boost::asio::buffer(bytes.data(), bytes.size()));
+        const auto done = clock::now();
+        for (const auto t: queued_at)
+        {
+            latencies.push_back(done - t);
+        }
+        queued_at.clear();
+        num_bytes += bytes.size();
+        ++num_writes;
+        queue.end_flush();
+    };
+
+    for (auto _: state)
+    {
+        for (std::size_t batch = 0; batch < num_batches; ++batch)
+        {
+            const auto batch_size = (batch * 7) % 16 + 1;
+            for (std::size_t i = 0; i < batch_size; ++i)
+            {
+                const auto now = clock::now();
+                queue.push(*replies[(batch + i) % replies.size()], now);
+                queued_at.push_back(now);
+                ++num_messages;
+                if (queue.flush_due(now))
+                {
+                    flush();
+                }
+            }
+            queue.end_batch();
+            if (queue.flush_due())
+            {
+                flush();
+            }
+        }
+
+        // Idle connection, wait for the threshold deadline.
+        if (queue.pending_bytes() > 0)
+        {
+            std::this_thread::sleep_until(queue.deadline());
+            flush();
+        }
+    }
+
+    std::ranges::sort(latencies);
+    const auto p99 = latencies.empty()
+                     ? clock::duration{}
+                     : latencies[(latencies.size() - 1) * 99 / 100];
+    state.SetItemsProcessed(static_cast<int64_t>(num_messages));
+    state.SetBytesProcessed(static_cast<int64_t>(num_bytes));
+    state.counters["msgs_per_write"] = static_cast<double>(num_messages) / static_cast<double>(num_writes);
+    state.counters["p99_latency_us"] = std::chrono::duration<double, std::micro>(p99).count();
+}
+
+// Server side of the scaling benchmark: decode every message and send it back.
+boost::asio::awaitable<void> bench_echo(boost::asio::ip::tcp::socket socket)
+{
+    std::vector<::umb::byte> recv_buf(64 * 1024);
+    std::vector<::umb::byte> send_buf;
+    ::umb::StreamParser parser;
+    auto& pool = testmessages::umb::thread_message_pool();
+
+    for (;;)
+    {
+        const auto [read_ec, num_read] = co_await socket.async_read_some(
+            boost::asio::buffer(recv_buf), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (read_ec)
+        {
+            co_return;
+        }
+
+        send_buf.clear();
+        const auto result = parser.push(std::span{recv_buf}.first(num_read), [&](const ::umb::StreamMessage& sm)
+        {
+            const auto msg = pool.acquire(static_cast<testmessages::umb::MessageType>(sm.type));
+            if (msg && msg->try_from_parts(sm.parts))
+            {
+                msg->to_packets(send_buf);
+            }
+        });
+        if (!result)
+        {
+            co_return;
+        }
+
+        const auto [write_ec, num_written] = co_await boost::asio::async_write(
+            socket, boost::asio::buffer(send_buf), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (write_ec)
+        {
+            co_return;
+        }
+    }
+}
+
+// Client connection whose writer thread keeps sending \stream. Echoed
+// bytes are read on the benchmark thread, concurrently with the writes.
+class EchoClient
+{
+public:
+    EchoClient(boost::asio::io_context& io,
+               const boost::asio::ip::tcp::endpoint& endpoint,
+               const std::vector<::umb::byte>& stream)
+        : m_socket(io)
+    {
+        m_socket.connect(endpoint);
+        m_writer = std::jthread([this, &stream](const std::stop_token& stop)
+        {
+            boost::system::error_code ec;
+            while (!stop.stop_requested() && !ec)
+            {
+                boost::asio::write(m_socket, boost::asio::buffer(stream), ec);
+            }
+        });
+    }
+
+    ~EchoClient()
+    {
+        m_writer.request_stop();
+        // Fails the writer's blocking write, close() alone does not.
+        boost::system::error_code ec;
+        m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        m_writer.join();
+    }
+
+    [[nodiscard]] boost::asio::ip::tcp::socket& socket() noexcept
+    {
+        return m_socket;
+    }
+
+private:
+    boost::asio::ip::tcp::socket m_socket;
+    std::jthread m_writer;
+};
+
+// Decode every message and queue it back, shared by both server backends.
+void bench_echo_message(const ::umb::StreamMessage& sm, ::umb::OutgoingQueue& queue)
+{
+    const auto msg = testmessages::umb::thread_message_pool().acquire(
+        static_cast<testmessages::umb::MessageType>(sm.type));
+    if (msg && msg->try_from_parts(sm.parts))
+    {
+        queue.push(*msg);
+    }
+}
+
+void run_echo_clients(benchmark::State& state, const boost::asio::ip::tcp::endpoint& endpoint)
+{
+    constexpr std::size_t num_clients = 16;
+    const auto stream = make_small_packet_stream();
+    boost::asio::io_context io;
+    std::vector<std::unique_ptr<EchoClient>> clients;
+    for (std::size_t i = 0; i < num_clients; ++i)
+    {
+        clients.push_back(std::make_unique<EchoClient>(io, endpoint, stream));
+    }
+    std::vector<::umb::byte> echoed(stream.size());
+
+    for (auto _: state)
+    {
+        for (const auto& client: clients)
+        {
+            boost::asio::read(client->socket(), boost::asio::buffer(echoed));
+        }
+    }
+
+    clients.clear();
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(num_clients * g_traffic_packets));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(num_clients * stream.size()));
+}
+
+// Echo throughput of umb::net::Server with 1 to N worker threads,
+// served to a fixed number of client connections.
+void BM_Server_EchoScaling(benchmark::State& state)
+{
+    umb::net::Server server{
+        {
+            .endpoint = {boost::asio::ip::address_v4::loopback(), 0},
+            .num_threads = static_cast<std::size_t>(state.range(0)),
+        },
+        [](boost::asio::ip::tcp::socket socket)
+        {
+            return bench_echo(std::move(socket));
+        }};
+    server.start();
+    run_echo_clients(state, server.local_endpoint());
+}
+
+void BM_Transport_Asio(benchmark::State& state)
+{
+    umb::net::Server server{
+        {
+            .endpoint = {boost::asio::ip::address_v4::loopback(), 0},
+            .num_threads = static_cast<std::size_t>(state.range(0)),
+        },
+        [](boost::asio::ip::tcp::socket socket)
+        {
+            return umb::net::serve_messages(std::move(socket), bench_echo_message);
+        }};
+    server.start();
+    run_echo_clients(state, server.local_endpoint());
+}
+
+#if UMB_NET_HAS_IO_URING
+
+void BM_Transport_IoUring(benchmark::State& state)
+{
+    umb::net::UringServer server{
+        {
+            .server = {
+                .endpoint = {boost::asio::ip::address_v4::loopback(), 0},
+                .num_threads = static_cast<std::size_t>(state.range(0)),
+            },
+        },
+        bench_echo_message};
+    server.start();
+    run_echo_clients(state, server.local_endpoint());
+}
+
+#endif // UMB_NET_HAS_IO_URING
+
+// Message with many float fields, one string and one bytes field.
+testmessages::umb::testmsg make_float_string_message()
+{
+    testmessages::umb::testmsg msg;
+    msg.set_one(1.5F);
+    msg.set_asd(-0.1F);
+    msg.set_fasd(3.14159F);
+    msg.set_nfghmfghj3452345(1e-20F);
+    msg.set_ffffff(u"a string field");
+    msg.set_a_field_with_some_bytes_that_do_some_things({1, 2, 3, 4, 5, 6, 7, 8});
+    return msg;
+}
+
+// Alternate a string field between two lengths, then encode.
+// The setter keeps the serialized size cached.
+void BM_SetAndEncode_CachedSize(benchmark::State& state)
+{
+    auto msg = make_float_string_message();
+    const std::u16string short_str = u"short";
+    const std::u16string long_str(40, u'x');
+    std::array<::umb::byte, ::umb::g_packet_size> buf{};
+    bool flip = false;
+
+    for (auto _: state)
+    {
+        msg.set_ffffff(flip ? long_str : short_str);
+        flip = !flip;
+        benchmark::DoNotOptimize(msg.serialized_size());
+        benchmark::DoNotOptimize(msg.to_bytes(buf));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Size query after decoding, which walks every field once.
+void BM_DecodeAndSize(benchmark::State& state)
+{
+    const auto packet = make_float_string_message().to_bytes();
+    testmessages::umb::testmsg msg;
+
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(msg.from_bytes(packet));
+        benchmark::DoNotOptimize(msg.serialized_size());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_DecodeStrings_Bytewise);
+BENCHMARK(BM_DecodeStrings_Generated);
+BENCHMARK(BM_EncodeStrings_Generated);
+BENCHMARK(BM_DecodeStrings_Inline);
+BENCHMARK(BM_EncodeStrings_Inline);
+BENCHMARK(BM_DecodeBatch_DefaultAllocator);
+BENCHMARK(BM_DecodeBatch_MonotonicArena);
+BENCHMARK(BM_DecodePerPacket_MakeShared);
+BENCHMARK(BM_DecodePerPacket_Pooled);
+BENCHMARK(BM_Dispatch_SharedPtrSwitch);
+BENCHMARK(BM_Dispatch_DecodeAny);
+BENCHMARK(BM_Dispatch_Router);
+BENCHMARK(BM_TracePacket_Format);
+BENCHMARK(BM_TracePacket_Binary);
+BENCHMARK(BM_SetAndEncode_CachedSize);
+BENCHMARK(BM_SetFloatsThenEncode)->Arg(1)->Arg(8)->Arg(32);
+BENCHMARK(BM_DecodeAndSize);
+BENCHMARK(BM_DecodeFloatHeavy);
+BENCHMARK(BM_ReadOneField_Decode);
+BENCHMARK(BM_ReadOneField_View);
+BENCHMARK(BM_EncodeFloat_Scientific);
+BENCHMARK(BM_EncodeFloat_Shortest);
+BENCHMARK(BM_IntRoundTrip_Bytewise);
+BENCHMARK(BM_IntRoundTrip_WordAtATime);
+BENCHMARK(BM_IntRoundTrip_Generated);
+BENCHMARK(BM_EncodeBatch_ToBytes);
+BENCHMARK(BM_EncodeBatch_Append);
+BENCHMARK(BM_Multipart_CopyToSendBuf);
+BENCHMARK(BM_Multipart_ToPackets);
+BENCHMARK(BM_Multipart_ScatterGather);
+BENCHMARK(BM_MultipartDecode_Reassemble);
+BENCHMARK(BM_MultipartDecode_Parts);
+BENCHMARK(BM_StreamParser_Push)->Arg(7)->Arg(64)->Arg(1460)->Arg(65536);
+BENCHMARK(BM_SocketRead_HeaderThenPayload);
+BENCHMARK(BM_SocketRead_Batched);
+// 0: immediate, 1: end_of_batch, 2: threshold.
+BENCHMARK(BM_OutgoingQueue_MixedTraffic)->Arg(0)->Arg(1)->Arg(2);
+BENCHMARK(BM_Server_EchoScaling)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+BENCHMARK(BM_Transport_Asio)->Arg(1)->Arg(4)->UseRealTime();
+#if UMB_NET_HAS_IO_URING
+BENCHMARK(BM_Transport_IoUring)->Arg(1)->Arg(4)->UseRealTime();
+#endif
+BENCHMARK(BM_DecodeStatic_PerFieldChecks);
+BENCHMARK(BM_DecodeStatic_ValidateOnce);
+BENCHMARK(BM_DecodeFailureHeavy_Exceptions)->Arg(0)->Arg(10)->Arg(50)->Arg(90);
+BENCHMARK(BM_DecodeFailureHeavy_Expected)->Arg(0)->Arg(10)->Arg(50)->Arg(90);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __JETBRAINS_IDE__
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#endif
+
+#include <array>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <new>
+
+#include <doctest/doctest.h>
+
+#include "umb/umb.hpp"
+
+#include "InlineMessages.umb.hpp"
+#include "TestMessages.umb.hpp"
+
+namespace
+{
+
+// Number of operator new calls while g_count_allocations is set.
+std::size_t g_allocations = 0;
+bool g_count_allocations = false;
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    if (g_count_allocations)
+    {
+        ++g_allocations;
+    }
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+TEST_CASE("inline storage message never allocates")
+{
+    inlinemessages::InlineMultiStringMessage msg;
+    inlinemessages::InlineMultiStringMessage out;
+    std::array<::umb::byte, ::umb::g_packet_size> buf{};
+
+    g_allocations = 0;
+    g_count_allocations = true;
+    msg.set_a(u"PlayerName_With_Clan_Tag");
+    msg.set_b(u"gg wp, that last round was close. rematch on the next map?");
+    msg.set_c(u"ääää");
+    const auto size = msg.serialized_size();
+    bool ok = msg.to_bytes(buf);
+    ok = out.from_bytes(std::span{buf}.first(size)) && ok;
+    g_count_allocations = false;
+
+    CHECK(ok);
+    CHECK_EQ(g_allocations, 0U);
+    CHECK_EQ(msg, out);
+}
+
+TEST_CASE("pooled messages are recycled without allocating")
+{
+    testmessages::umb::MultiStringMessage in;
+    in.set_a(std::u16string(100, u'a'));
+    in.set_b(u"b");
+    const auto packet = in.to_bytes();
+    auto& pool = testmessages::umb::thread_message_pool();
+    const auto type = testmessages::umb::MessageType::MultiStringMessage;
+
+    // Warm up the pool and the string capacities.
+    REQUIRE(pool.acquire(type)->from_bytes(packet));
+
+    bool ok = true;
+    g_allocations = 0;
+    g_count_allocations = true;
+    for (int i = 0; i < 8; ++i)
+    {
+        const auto msg = pool.acquire(type);
+        ok = msg->from_bytes(packet) && ok;
+    }
+    g_count_allocations = false;
+
+    CHECK(ok);
+    CHECK_EQ(g_allocations, 0U);
+}
+
+TEST_CASE("decode_any receive loop does not allocate")
+{
+    inlinemessages::InlineMultiStringMessage ims;
+    ims.set_a(u"a");
+    ims.set_b(std::u16string(100, u'b'));
+    inlinemessages::BoundedInlineMessage bim;
+    bim.set_id(5);
+    bim.set_name(u"name");
+    const auto packet1 = ims.to_bytes();
+    const auto packet2 = bim.to_bytes();
+    std::array<::umb::byte, ::umb::g_packet_size> buf{};
+    inlinemessages::AnyMessage any;
+
+    bool ok = true;
+    g_allocations = 0;
+    g_count_allocations = true;
+    for (int i = 0; i < 8; ++i)
+    {
+        ok = inlinemessages::decode_any(packet1, any).has_value() && ok;
+        ok = inlinemessages::encode_any(any, buf) && ok;
+        ok = inlinemessages::decode_any(packet2, any).has_value() && ok;
+        ok = inlinemessages::encode_any(any, buf) && ok;
+    }
+    g_count_allocations = false;
+
+    CHECK(ok);
+    CHECK_EQ(g_allocations, 0U);
+}
+
+// Only possible with reflection.
+// TODO: disabled entirely on Windows due to a compiler bug.
+// https://developercommunity.visualstudio.com/t/Capture-of-constexpr-variable-not-workin/10190629?sort=active&topics=windows+10.0
+#if defined(UMB_INCLUDE_META) && !UMB_WINDOWS
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/hana.hpp>
+#include <boost/hana/for_each.hpp>
+
+#include "MoreMessage.umb.hpp"
+#include "PmrMessages.umb.hpp"
+
+namespace
+{
+
+constexpr std::size_t g_long_dynamic_size = 200;
+constexpr std::size_t g_short_dynamic_size = 3;
+constexpr int g_steady_state_rounds = 8;
+
+// Generated meta functions for a single message definition file.
+// Namespaces cannot be template arguments, so wrap them in a type.
+#define UMB_ALLOC_TEST_META(name, ns)                                        \
+    struct name                                                              \
+    {                                                                        \
+        static constexpr auto message_types()                                \
+        {                                                                    \
+            return ns::meta::message_types();                                \
+        }                                                                    \
+        template<auto MT>                                                    \
+        static auto make_shared_message()                                    \
+        {                                                                    \
+            return ns::meta::make_shared_message<MT>();                      \
+        }                                                                    \
+        template<auto MT>                                                    \
+        using Message = ns::meta::Message<MT>;                               \
+        template<auto MT, auto FT, const auto& FN, typename DynType>         \
+        static void set_field_dynamic(                                       \
+            std::shared_ptr<::umb::Message> msg, const DynType& value)       \
+        {                                                                    \
+            ns::meta::set_field_dynamic<MT, FT, FN>(std::move(msg), value);  \
+        }                                                                    \
+        template<auto MT, auto FT, const auto& FN>                           \
+        using FieldValue = std::remove_cvref_t<decltype(                     \
+            ns::meta::get_field<MT, FT, FN>(nullptr))>;                      \
+    }
+
+UMB_ALLOC_TEST_META(TestMessagesMeta, ::testmessages::umb);
+UMB_ALLOC_TEST_META(MoreMessageMeta, ::moremessages);
+UMB_ALLOC_TEST_META(InlineMessagesMeta, ::inlinemessages);
+UMB_ALLOC_TEST_META(PmrMessagesMeta, ::pmrmessages);
+
+#undef UMB_ALLOC_TEST_META
+
+// Counts allocations of std::pmr containers, which
+// do not go through the replaced operator new.
+class CountingResource: public std::pmr::memory_resource
+{
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if (g_count_allocations)
+        {
+            ++g_allocations;
+        }
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// Inline storage fields are limited to their capacity.
+template<typename T>
+constexpr std::size_t field_size(std::size_t size)
+{
+    if constexpr (requires { T::capacity(); })
+    {
+        return std::min(size, T::capacity());
+    }
+    else
+    {
+        return size;
+    }
+}
+
+template<typename Meta, auto MT>
+void set_dynamic_fields(const std::shared_ptr<::umb::Message>& msg, std::size_t size)
+{
+    using Message = typename Meta::template Message<MT>;
+    constexpr auto field_seq = std::make_integer_sequence<uint64_t, Message::field_count()>();
+
+    boost::hana::for_each(field_seq, [&msg, size](const auto findex)
+    {
+        constexpr auto field = Message::template field<findex>();
+        using Value = typename Meta::template FieldValue<MT, field.type, field.name>;
+        if constexpr (field.type == ::umb::meta::FieldType::String)
+        {
+            const std::u16string str(field_size<Value>(size), u'ä');
+            Meta::template set_field_dynamic<MT, field.type, field.name>(msg, str);
+        }
+        else if constexpr (field.type == ::umb::meta::FieldType::Bytes)
+        {
+            const std::vector<::umb::byte> bytes(field_size<Value>(size), 0xab);
+            Meta::template set_field_dynamic<MT, field.type, field.name>(msg, bytes);
+        }
+    });
+}
+
+// Decode packets with long and short dynamic fields into the same
+// message object. Once the first long packet has been decoded, no
+// further decode may allocate.
+template<typename Meta>
+void check_steady_state_decode()
+{
+    constexpr auto seq = std::make_integer_sequence<uint16_t, Meta::message_types().size()>();
+
+    boost::hana::for_each(seq, [](const auto index)
+    {
+        constexpr auto idx = decltype(index)::value;
+
+        // Skip MessageType::None.
+        if constexpr (idx > 0)
+        {
+            constexpr auto mt = Meta::message_types()[idx];
+
+            const auto msg = Meta::template make_shared_message<mt>();
+            set_dynamic_fields<Meta, mt>(msg, g_long_dynamic_size);
+            const auto long_packet = msg->to_bytes();
+            set_dynamic_fields<Meta, mt>(msg, g_short_dynamic_size);
+            const auto short_packet = msg->to_bytes();
+
+            const auto out = Meta::template make_shared_message<mt>();
+            REQUIRE(out->from_bytes(long_packet));
+
+            bool ok = true;
+            g_allocations = 0;
+            g_count_allocations = true;
+            for (int i = 0; i < g_steady_state_rounds; ++i)
+            {
+                ok = out->from_bytes(short_packet) && ok;
+                ok = out->from_bytes(long_packet) && ok;
+            }
+            g_count_allocations = false;
+
+            INFO(std::format("message type: {}", idx));
+            CHECK(ok);
+            CHECK_EQ(g_allocations, 0U);
+        }
+    });
+}
+
+} // namespace
+
+TEST_CASE("reused message decodes without allocating")
+{
+    static CountingResource counting;
+    std::pmr::memory_resource* const old_resource = std::pmr::set_default_resource(&counting);
+
+    check_steady_state_decode<TestMessagesMeta>();
+    check_steady_state_decode<MoreMessageMeta>();
+    check_steady_state_decode<InlineMessagesMeta>();
+    check_steady_state_decode<PmrMessagesMeta>();
+
+    std::pmr::set_default_resource(old_resource);
+}
+
+#else
+
+TEST_CASE("skipping allocation tests")
+{
+    std::cout << std::format("UMB_WINDOWS={}, skipping allocation tests\n", UMB_WINDOWS);
+    CHECK(true);
+}
+
+#endif // defined(UMB_INCLUDE_META) && !UMB_WINDOWS
@@ -18,8 +18,20 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #endif
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
 #include <cmath>
 #include <limits>
+#include <memory_resource>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#include <variant>
+#include <utility>
+#include <vector>
 
 #include <unicode/unistr.h>
 #include <unicode/ustream.h>
@@ -28,8 +40,11 @@
 
 #include "umb/umb.hpp"
 #include "umb/meta.hpp"
+#include "umb/trace.hpp"
 
+#include "InlineMessages.umb.hpp"
 #include "MoreMessage.umb.hpp"
+#include "PmrMessages.umb.hpp"
 #include "TestMessages.umb.hpp"
 
 TEST_CASE("encode decode empty message")
@@ -452,3 +467,1076 @@ TEST_CASE("test meta get")
 
     REQUIRE((asd == doctest::Approx(val)));
 }
+
+TEST_CASE("try_from_bytes truncated message")
+{
+    testmessages::umb::GetSomeStuffResp msg1;
+    testmessages::umb::GetSomeStuffResp msg2;
+    msg1.set_session(5);
+    msg1.set_userid(6);
+
+    const auto bytes = msg1.to_bytes();
+    auto result = msg2.try_from_bytes(bytes);
+    CHECK(result.has_value());
+    CHECK_EQ(msg1, msg2);
+
+    // Header only.
+    result = msg2.try_from_bytes(std::span{bytes}.first(::umb::g_header_size));
+    REQUIRE_FALSE(result.has_value());
+    CHECK_EQ(result.error().error, ::umb::DecodeError::not_enough_bytes);
+    CHECK_EQ(result.error().field, "session");
+    CHECK_EQ(result.error().offset, ::umb::g_header_size);
+
+    // Last field cut short.
+    result = msg2.try_from_bytes(std::span{bytes}.first(bytes.size() - 1));
+    REQUIRE_FALSE(result.has_value());
+    CHECK_EQ(result.error().error, ::umb::DecodeError::not_enough_bytes);
+    CHECK_EQ(result.error().field, "userid");
+    CHECK_EQ(result.error().offset, ::umb::g_header_size + ::umb::g_sizeof_int32);
+
+    // Not even a full header.
+    result = msg2.try_from_bytes(std::span{bytes}.first(2));
+    REQUIRE_FALSE(result.has_value());
+    CHECK(result.error().field.empty());
+    CHECK_FALSE(msg2.from_bytes(std::span{bytes}.first(2)));
+}
+
+TEST_CASE("try_from_bytes truncated dynamic fields")
+{
+    testmessages::umb::DualStringMessage msg1;
+    testmessages::umb::DualStringMessage msg2;
+    msg1.set_a(u"first");
+    msg1.set_b(u"second");
+
+    const auto bytes = msg1.to_bytes();
+    for (size_t i = 0; i < bytes.size(); ++i)
+    {
+        CHECK_FALSE(msg2.try_from_bytes(std::span{bytes}.first(i)).has_value());
+    }
+    CHECK(msg2.try_from_bytes(bytes).has_value());
+    CHECK_EQ(msg1, msg2);
+
+    const auto result = msg2.try_from_bytes(std::span{bytes}.first(bytes.size() - 1));
+    REQUIRE_FALSE(result.has_value());
+    CHECK_EQ(result.error().field, "b");
+    CHECK_EQ(result.error().offset, ::umb::g_header_size + 1 + (5 * ::umb::g_sizeof_uscript_char));
+}
+
+TEST_CASE("try_from_bytes malformed float")
+{
+    testmessages::umb::JustAnotherTestMessage msg1;
+    testmessages::umb::JustAnotherTestMessage msg2;
+    msg1.set_some_floatVAR(1.5F);
+
+    auto bytes = msg1.to_bytes();
+    // Replace the first character of the float string with garbage.
+    bytes[::umb::g_header_size + 1] = 'x';
+
+    const auto result = msg2.try_from_bytes(bytes);
+    REQUIRE_FALSE(result.has_value());
+    CHECK_EQ(result.error().error, ::umb::DecodeError::invalid_float);
+    CHECK_EQ(result.error().field, "some_floatVAR");
+    CHECK_EQ(result.error().offset, ::umb::g_header_size);
+
+    // Should not throw.
+    CHECK_FALSE(msg2.from_bytes(bytes));
+
+    // Valid prefix followed by garbage.
+    bytes = msg1.to_bytes();
+    REQUIRE_EQ(bytes[::umb::g_header_size], 3);
+    bytes[::umb::g_header_size + 3] = 'x';
+    CHECK_EQ(msg2.try_from_bytes(bytes).error().error, ::umb::DecodeError::invalid_float);
+}
+
+TEST_CASE("validate_size")
+{
+    testmessages::umb::STATIC_BoolPackingMessage sbpm;
+    const auto static_bytes = sbpm.to_bytes();
+    CHECK(testmessages::umb::STATIC_BoolPackingMessage::validate_size(static_bytes));
+    CHECK_FALSE(testmessages::umb::STATIC_BoolPackingMessage::validate_size(
+        std::span{static_bytes}.first(static_bytes.size() - 1)));
+
+    testmessages::umb::BoolPackingMessage bpm;
+    bpm.set_float_delimiter_asd(-0.25F);
+    bpm.set_end_msg_with_some_dynamic_stuff(u"dynamic stuff");
+    const auto dynamic_bytes = bpm.to_bytes();
+    CHECK(testmessages::umb::BoolPackingMessage::validate_size(dynamic_bytes));
+    for (size_t i = 0; i < dynamic_bytes.size(); ++i)
+    {
+        CHECK_FALSE(testmessages::umb::BoolPackingMessage::validate_size(
+            std::span{dynamic_bytes}.first(i)));
+    }
+}
+
+TEST_CASE("encode decode full byte of packed bools")
+{
+    // 8 bools must take exactly 1 byte, 9 bools exactly 2 bytes.
+    std::array<::umb::byte, 3> buf{0xff, 0xff, 0xff};
+    const std::span<::umb::byte> span{buf};
+    auto wi = span.begin();
+    ::umb::encode_packed_bools(wi, true, false, true, false, false, false, false, true);
+    CHECK_EQ(std::distance(span.begin(), wi), 1);
+    CHECK_EQ(buf[0], 0b10000101);
+    CHECK_EQ(buf[1], 0xff);
+
+    std::array<bool, 8> out{};
+    const std::span<const ::umb::byte> one_byte{buf.data(), 1};
+    auto ri = one_byte.cbegin();
+    ::umb::decode_packed_bools(ri, one_byte,
+                               out[0], out[1], out[2], out[3], out[4], out[5], out[6], out[7]);
+    CHECK_EQ(ri, one_byte.cend());
+    CHECK((out == std::array{true, false, true, false, false, false, false, true}));
+
+    wi = span.begin();
+    ::umb::encode_packed_bools(wi, false, false, false, false, false, false, false, false, true);
+    CHECK_EQ(std::distance(span.begin(), wi), 2);
+    CHECK_EQ(buf[0], 0);
+    CHECK_EQ(buf[1], 1);
+}
+
+TEST_CASE("little-endian integer load store")
+{
+    std::array<::umb::byte, 5> buf{};
+    ::umb::store_le<int32_t>(-2, buf.data() + 1);
+    CHECK_EQ(buf[0], 0x00);
+    CHECK_EQ(buf[1], 0xfe);
+    CHECK_EQ(buf[2], 0xff);
+    CHECK_EQ(buf[3], 0xff);
+    CHECK_EQ(buf[4], 0xff);
+    CHECK_EQ(::umb::load_le<int32_t>(buf.data() + 1), -2);
+
+    ::umb::store_le<uint16_t>(0x1234, buf.data() + 1);
+    CHECK_EQ(buf[1], 0x34);
+    CHECK_EQ(buf[2], 0x12);
+    CHECK_EQ(::umb::load_le<uint16_t>(buf.data() + 1), 0x1234);
+
+    static constexpr std::array<::umb::byte, 2> le{0xcd, 0xab};
+    static_assert(::umb::load_le<uint16_t>(le.data()) == 0xabcd);
+
+    testmessages::umb::GetSomeStuffResp msg;
+    msg.set_session(std::numeric_limits<int32_t>::min());
+    msg.set_userid(0x01020304);
+    const auto bytes = msg.to_bytes();
+
+    ::umb::byte size = 0;
+    ::umb::byte part = 0;
+    uint16_t type = 0;
+    auto hi = std::span<const ::umb::byte>{bytes}.cbegin();
+    ::umb::decode_header_unchecked(hi, size, part, type);
+    CHECK_EQ(size, bytes.size());
+    CHECK_EQ(part, ::umb::g_part_single_part);
+    CHECK_EQ(type, static_cast<uint16_t>(testmessages::umb::MessageType::GetSomeStuffResp));
+    CHECK_EQ(bytes[::umb::g_header_size], 0x00);
+    CHECK_EQ(bytes[::umb::g_header_size + 3], 0x80);
+    CHECK_EQ(bytes[::umb::g_header_size + 4], 0x04);
+    CHECK_EQ(bytes[::umb::g_header_size + 7], 0x01);
+
+    testmessages::umb::GetSomeStuffResp msg2;
+    CHECK(msg2.from_bytes(bytes));
+    CHECK_EQ(msg, msg2);
+}
+
+TEST_CASE("encode_float shortest round trip")
+{
+    ::umb::FloatString str;
+    ::umb::encode_float(0.1F, str);
+    CHECK_EQ(str.view(), "0.1");
+    ::umb::encode_float(-2.5e-20F, str);
+    CHECK_EQ(str.view(), "-2.5e-20");
+    ::umb::encode_float(1024.0F, str);
+    CHECK_EQ(str.view(), "1024");
+
+    // Dense sample of all 32-bit float bit patterns.
+    constexpr uint64_t stride = 4093;
+    for (uint64_t bits = 0; bits <= std::numeric_limits<uint32_t>::max(); bits += stride)
+    {
+        const auto f = std::bit_cast<float>(static_cast<uint32_t>(bits));
+        ::umb::encode_float(f, str);
+        REQUIRE_LE(str.size(), ::umb::FloatString::capacity());
+
+        if (std::isnan(f) || std::isinf(f))
+        {
+            continue;
+        }
+
+        // Only characters UnrealScript's float(FloatStr) understands.
+        for (const auto c: str.view())
+        {
+            REQUIRE(((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e'));
+        }
+
+        float parsed = 0;
+        const auto [_, ec] = std::from_chars(str.data(), str.data() + str.size(), parsed);
+        REQUIRE(ec == std::errc());
+        REQUIRE_EQ(std::bit_cast<uint32_t>(parsed), static_cast<uint32_t>(bits));
+    }
+}
+
+TEST_CASE("decoded float is re-encoded on demand")
+{
+    // Fixed notation float string, as sent by UnrealScript.
+    const std::string float_str = "340282346638528859811704183484516925440.000000";
+    std::vector<::umb::byte> bytes(::umb::g_header_size);
+    bytes.push_back(static_cast<::umb::byte>(float_str.size()));
+    bytes.insert(bytes.end(), float_str.cbegin(), float_str.cend());
+    bytes.push_back(0x7f);
+    auto wi = std::span{bytes}.begin();
+    ::umb::encode_header(static_cast<::umb::byte>(bytes.size()), ::umb::g_part_single_part,
+                         static_cast<uint16_t>(testmessages::umb::MessageType::JustAnotherTestMessage), wi);
+
+    testmessages::umb::JustAnotherTestMessage msg;
+    REQUIRE(msg.from_bytes(bytes));
+    CHECK_EQ(msg.some_floatVAR(), std::numeric_limits<float>::max());
+    CHECK_EQ(msg.ByteVarX(), 0x7f);
+
+    // Re-encoded in the shortest form, "3.4028235e+38".
+    const auto out = msg.to_bytes();
+    CHECK_EQ(out.size(), msg.serialized_size());
+    CHECK_EQ(out.size(), ::umb::g_header_size + 1 + 13 + 1);
+
+    testmessages::umb::JustAnotherTestMessage msg2;
+    REQUIRE(msg2.from_bytes(out));
+    CHECK_EQ(msg, msg2);
+}
+
+TEST_CASE("encode decode UCS-2 string wire layout")
+{
+    const std::u16string str = u"Aä䮟";
+    std::array<::umb::byte, 1 + 3 * ::umb::g_sizeof_uscript_char> buf{};
+    auto wi = std::span{buf}.begin();
+    ::umb::encode_string(str, wi);
+    CHECK_EQ(wi, std::span{buf}.end());
+    CHECK((buf == std::array<::umb::byte, 7>{3, 0x41, 0x00, 0xe4, 0x00, 0x9f, 0x4b}));
+
+    // Decoding overwrites the existing contents in place.
+    std::u16string out(200, u'x');
+    const std::span<const ::umb::byte> in{buf};
+    auto ri = in.cbegin();
+    ::umb::decode_string(ri, in, out);
+    CHECK_EQ(ri, in.cend());
+    CHECK_EQ(out, str);
+
+    const std::u16string longest(::umb::g_max_dynamic_size, u'￮');
+    std::vector<::umb::byte> long_buf(1 + longest.size() * ::umb::g_sizeof_uscript_char);
+    wi = std::span{long_buf}.begin();
+    ::umb::encode_string(longest, wi);
+    ri = std::span<const ::umb::byte>{long_buf}.cbegin();
+    ::umb::decode_string(ri, long_buf, out);
+    CHECK_EQ(out, longest);
+}
+
+TEST_CASE("message view reads fields in place")
+{
+    testmessages::umb::BoolPackingMessage bpm;
+    bpm.set_pack1(true);
+    bpm.set_pack_end_byte_3(true);
+    bpm.set_int_pack_delimiter(-123456);
+    bpm.set_unoptimized_lone_bool(true);
+    bpm.set_some_byte_delimiter(0xfe);
+    bpm.set_float_delimiter_asd(-0.25F);
+    bpm.set_bool_10_part_pack__7(true);
+    bpm.set_bool_10_part_pack__9(true);
+    bpm.set_int_after_long_pack(42);
+    bpm.set_partial_byte_pack_end_1(true);
+    bpm.set_end_msg_with_some_dynamic_stuff(u"dynamic stuff ä");
+    const auto bpm_bytes = bpm.to_bytes();
+
+    const auto bpm_view = testmessages::umb::BoolPackingMessageView::try_from_bytes(bpm_bytes);
+    REQUIRE(bpm_view.has_value());
+    CHECK_EQ(bpm_view->pack_start_0(), bpm.pack_start_0());
+    CHECK_EQ(bpm_view->pack1(), bpm.pack1());
+    CHECK_EQ(bpm_view->pack2(), bpm.pack2());
+    CHECK_EQ(bpm_view->pack_end_byte_3(), bpm.pack_end_byte_3());
+    CHECK_EQ(bpm_view->int_pack_delimiter(), bpm.int_pack_delimiter());
+    CHECK_EQ(bpm_view->unoptimized_lone_bool(), bpm.unoptimized_lone_bool());
+    CHECK_EQ(bpm_view->some_byte_delimiter(), bpm.some_byte_delimiter());
+    REQUIRE(bpm_view->float_delimiter_asd().has_value());
+    CHECK_EQ(*bpm_view->float_delimiter_asd(), bpm.float_delimiter_asd());
+    CHECK_EQ(bpm_view->bool_10_part_pack__0(), bpm.bool_10_part_pack__0());
+    CHECK_EQ(bpm_view->bool_10_part_pack__7(), bpm.bool_10_part_pack__7());
+    CHECK_EQ(bpm_view->bool_10_part_pack__8(), bpm.bool_10_part_pack__8());
+    CHECK_EQ(bpm_view->bool_10_part_pack__9(), bpm.bool_10_part_pack__9());
+    CHECK_EQ(bpm_view->int_after_long_pack(), bpm.int_after_long_pack());
+    CHECK_EQ(bpm_view->partial_byte_pack_start_0(), bpm.partial_byte_pack_start_0());
+    CHECK_EQ(bpm_view->partial_byte_pack_end_1(), bpm.partial_byte_pack_end_1());
+    CHECK(bpm_view->end_msg_with_some_dynamic_stuff() == bpm.end_msg_with_some_dynamic_stuff());
+    CHECK_EQ(bpm_view->end_msg_with_some_dynamic_stuff().to_u16string(), bpm.end_msg_with_some_dynamic_stuff());
+
+    testmessages::umb::testmsg tm;
+    tm.set_one(1.0F);
+    tm.set_nnnffgg(-987.654F);
+    tm.set_nmmmgfgg234(7);
+    tm.set_aa(-1);
+    tm.set_ffffff(u"ffffff");
+    tm.set_a_field_with_some_bytes_that_do_some_things({1, 2, 3, 4});
+    const auto tm_bytes = tm.to_bytes();
+
+    const auto tm_view = testmessages::umb::testmsgView::try_from_bytes(tm_bytes);
+    REQUIRE(tm_view.has_value());
+    CHECK_EQ(tm_view->one().value(), tm.one());
+    CHECK_EQ(tm_view->nnnffgg().value(), tm.nnnffgg());
+    CHECK_EQ(tm_view->nmmmgfgg234(), tm.nmmmgfgg234());
+    CHECK_EQ(tm_view->aa(), tm.aa());
+    CHECK(tm_view->ffffff() == tm.ffffff());
+    const auto view_bytes = tm_view->a_field_with_some_bytes_that_do_some_things();
+    const auto& msg_bytes = tm.a_field_with_some_bytes_that_do_some_things();
+    CHECK(std::equal(view_bytes.begin(), view_bytes.end(), msg_bytes.cbegin(), msg_bytes.cend()));
+
+    for (size_t i = 0; i < tm_bytes.size(); ++i)
+    {
+        CHECK_FALSE(testmessages::umb::testmsgView::try_from_bytes(std::span{tm_bytes}.first(i)).has_value());
+    }
+}
+
+TEST_CASE("encode decode inline storage fields")
+{
+    using inlinemessages::BoundedInlineMessage;
+    static_assert(std::is_same_v<std::remove_cvref_t<decltype(std::declval<BoundedInlineMessage>().name())>,
+                                 ::umb::InlineString<16>>);
+    static_assert(std::is_same_v<std::remove_cvref_t<decltype(std::declval<BoundedInlineMessage>().payload())>,
+                                 ::umb::InlineBytes<8>>);
+    static_assert(std::is_same_v<std::remove_cvref_t<decltype(std::declval<BoundedInlineMessage>().heap_string())>,
+                                 std::u16string>);
+
+    BoundedInlineMessage msg1;
+    BoundedInlineMessage msg2;
+    msg1.set_id(99);
+    msg1.set_name(u"ääkkönen");
+    msg1.set_payload(std::vector<::umb::byte>{1, 2, 3, 0xff});
+    msg1.set_heap_string(u"not inline");
+    const auto bytes = msg1.to_bytes();
+    REQUIRE(msg2.try_from_bytes(bytes).has_value());
+    CHECK_EQ(msg1, msg2);
+    CHECK_EQ(msg2.name().view(), u"ääkkönen");
+    CHECK_EQ(msg2.payload().size(), 4U);
+
+    // Inline and heap storage share the same wire format.
+    testmessages::umb::MultiStringMessage heap_msg;
+    heap_msg.set_a(u"a");
+    heap_msg.set_b(std::u16string(::umb::g_max_dynamic_size, u'b'));
+    inlinemessages::InlineMultiStringMessage inline_msg;
+    REQUIRE(inline_msg.from_bytes(heap_msg.to_bytes()));
+    CHECK_EQ(inline_msg.a().view(), heap_msg.a());
+    CHECK_EQ(inline_msg.b().view(), heap_msg.b());
+    CHECK(inline_msg.c().empty());
+    CHECK_EQ(inline_msg.to_bytes(), heap_msg.to_bytes());
+
+    CHECK_THROWS_AS(msg1.set_name(std::u16string(17, u'x')), std::invalid_argument);
+    CHECK_THROWS_AS(msg1.set_payload(std::vector<::umb::byte>(9)), std::invalid_argument);
+}
+
+TEST_CASE("decode inline storage field over capacity")
+{
+    // 17 characters, one more than the capacity of name.
+    std::vector<::umb::byte> bytes(::umb::g_header_size + ::umb::g_sizeof_int32);
+    bytes.push_back(17);
+    for (int i = 0; i < 17; ++i)
+    {
+        bytes.push_back('x');
+        bytes.push_back(0);
+    }
+    bytes.push_back(0); // payload
+    bytes.push_back(0); // heap_string
+    auto wi = std::span{bytes}.begin();
+    ::umb::encode_header(static_cast<::umb::byte>(bytes.size()), ::umb::g_part_single_part,
+                         static_cast<uint16_t>(inlinemessages::MessageType::BoundedInlineMessage), wi);
+
+    inlinemessages::BoundedInlineMessage msg;
+    const auto offset = ::umb::g_header_size + ::umb::g_sizeof_int32;
+    auto result = msg.try_from_bytes(bytes);
+    REQUIRE_FALSE(result.has_value());
+    CHECK_EQ(result.error().error, ::umb::DecodeError::capacity_exceeded);
+    CHECK_EQ(result.error().field, "name");
+    CHECK_EQ(result.error().offset, offset);
+
+    // Checked decode path reports the same error.
+    bytes.pop_back();
+    result = msg.try_from_bytes(bytes);
+    REQUIRE_FALSE(result.has_value());
+    CHECK_EQ(result.error().error, ::umb::DecodeError::capacity_exceeded);
+    CHECK_EQ(result.error().field, "name");
+}
+
+TEST_CASE("decode pmr message into a monotonic arena")
+{
+    pmrmessages::PmrChatMessage msg1;
+    msg1.set_sender(7);
+    msg1.set_a(u"PlayerName_With_Clan_Tag");
+    msg1.set_b(u"gg wp, that last round was close. rematch on the next map?");
+    msg1.set_c(std::u16string(80, u'ä'));
+    msg1.set_attachment(std::vector<::umb::byte>(40, 0xab));
+    msg1.set_channel(u"all");
+    const auto bytes = msg1.to_bytes();
+
+    std::array<std::byte, 2048> buf{};
+    std::pmr::monotonic_buffer_resource arena{buf.data(), buf.size(), std::pmr::null_memory_resource()};
+    pmrmessages::PmrChatMessage msg2{&arena};
+    REQUIRE(msg2.try_from_bytes(bytes).has_value());
+    CHECK_EQ(msg1, msg2);
+    CHECK_EQ(msg2.a().get_allocator().resource(), &arena);
+    CHECK_EQ(msg2.attachment().get_allocator().resource(), &arena);
+    CHECK_EQ(msg2.channel().view(), u"all");
+
+    // Setters keep using the message's resource.
+    msg2.set_b(std::u16string(100, u'b'));
+    msg2.set_attachment(std::vector<::umb::byte>(100, 1));
+    CHECK_EQ(msg2.b().get_allocator().resource(), &arena);
+    CHECK_EQ(msg2.attachment().get_allocator().resource(), &arena);
+
+    pmrmessages::PmrStaticMessage sm{&arena};
+    CHECK_EQ(sm.value(), 0);
+}
+
+TEST_CASE("reset restores defaults and pool recycles messages")
+{
+    testmessages::umb::testmsg msg1;
+    const testmessages::umb::testmsg defaults;
+    msg1.set_one(1.5F);
+    msg1.set_aa(-5);
+    msg1.set_ffffff(std::u16string(100, u'f'));
+    msg1.set_a_field_with_some_bytes_that_do_some_things({1, 2, 3});
+    msg1.reset();
+    CHECK_EQ(msg1, defaults);
+    CHECK_EQ(msg1.to_bytes(), defaults.to_bytes());
+    CHECK_GE(msg1.ffffff().capacity(), 100U);
+
+    ::umb::MessagePool<testmessages::umb::MultiStringMessage> pool{1};
+    const testmessages::umb::MultiStringMessage* first = nullptr;
+    {
+        auto msg = pool.acquire();
+        first = msg.get();
+        msg->set_a(u"recycled");
+    }
+    CHECK_EQ(pool.free_count(), 1U);
+    {
+        auto msg = pool.acquire();
+        CHECK_EQ(msg.get(), first);
+        CHECK(msg->a().empty());
+        CHECK_EQ(pool.free_count(), 0U);
+
+        // Pool is full, the second message is deleted on release.
+        auto other = pool.acquire();
+        CHECK_NE(other.get(), first);
+    }
+    CHECK_EQ(pool.free_count(), 1U);
+
+    auto& tpool = testmessages::umb::thread_message_pool();
+    const auto any = tpool.acquire(testmessages::umb::MessageType::DualStringMessage);
+    REQUIRE(any);
+    CHECK_EQ(any->type(), static_cast<uint16_t>(testmessages::umb::MessageType::DualStringMessage));
+    CHECK_FALSE(tpool.acquire(testmessages::umb::MessageType::None));
+}
+
+TEST_CASE("messages are copyable and movable")
+{
+    using testmessages::umb::testmsg;
+    static_assert(std::is_nothrow_move_constructible_v<testmsg>);
+    static_assert(std::is_nothrow_move_assignable_v<testmsg>);
+    static_assert(std::is_copy_constructible_v<testmsg>);
+    static_assert(std::is_nothrow_move_constructible_v<inlinemessages::BoundedInlineMessage>);
+    static_assert(std::is_nothrow_move_constructible_v<pmrmessages::PmrChatMessage>);
+    static_assert(!std::is_copy_assignable_v<::umb::Message>);
+    static_assert(!std::is_move_assignable_v<::umb::Message>);
+
+    testmsg msg;
+    msg.set_one(0.1F);
+    msg.set_aa(1234);
+    msg.set_ffffff(u"copied");
+    msg.set_a_field_with_some_bytes_that_do_some_things({1, 2});
+
+    const testmsg copy = msg;
+    CHECK_EQ(copy, msg);
+    CHECK_EQ(copy.to_bytes(), msg.to_bytes());
+
+    std::vector<testmsg> queue;
+    queue.push_back(msg);
+    queue.push_back(std::move(msg));
+    queue.emplace_back();
+    CHECK_EQ(queue[0], copy);
+    CHECK_EQ(queue[1], copy);
+    CHECK_NE(queue[2], copy);
+
+    testmsg moved = std::move(queue[1]);
+    CHECK_EQ(moved, copy);
+    queue[2] = moved;
+    CHECK_EQ(queue[2], copy);
+
+    // Decoded float caches survive copies.
+    testmsg decoded;
+    REQUIRE(decoded.from_bytes(copy.to_bytes()));
+    const testmsg decoded_copy = decoded;
+    CHECK_EQ(decoded_copy.to_bytes(), copy.to_bytes());
+}
+
+TEST_CASE("decode_any dispatches on message type")
+{
+    testmessages::umb::DualStringMessage dsm;
+    dsm.set_a(u"first");
+    dsm.set_b(u"second");
+    testmessages::umb::GetSomeStuffResp gssr;
+    gssr.set_session(1);
+    gssr.set_userid(2);
+
+    auto result = testmessages::umb::decode_any(dsm.to_bytes());
+    REQUIRE(result.has_value());
+    REQUIRE(std::holds_alternative<testmessages::umb::DualStringMessage>(*result));
+    CHECK_EQ(std::get<testmessages::umb::DualStringMessage>(*result), dsm);
+
+    // Decoding in place switches the alternative when the type changes.
+    testmessages::umb::AnyMessage any = std::move(*result);
+    REQUIRE(testmessages::umb::decode_any(gssr.to_bytes(), any).has_value());
+    REQUIRE(std::holds_alternative<testmessages::umb::GetSomeStuffResp>(any));
+    CHECK_EQ(std::get<testmessages::umb::GetSomeStuffResp>(any), gssr);
+
+    const auto bytes = gssr.to_bytes();
+    CHECK_EQ(testmessages::umb::serialized_size(any), bytes.size());
+    std::vector<::umb::byte> out(bytes.size());
+    REQUIRE(testmessages::umb::encode_any(any, out));
+    CHECK_EQ(out, bytes);
+
+    // Errors.
+    CHECK_EQ(testmessages::umb::decode_any(std::span{bytes}.first(2)).error().error,
+             ::umb::DecodeError::not_enough_bytes);
+    CHECK_EQ(testmessages::umb::decode_any(std::span{bytes}.first(bytes.size() - 1)).error().field, "userid");
+    auto bad_type = bytes;
+    bad_type[2] = 0xff;
+    CHECK_EQ(testmessages::umb::decode_any(bad_type).error().error, ::umb::DecodeError::unknown_message_type);
+    bad_type[2] = 0;
+    bad_type[3] = 0;
+    CHECK_EQ(testmessages::umb::decode_any(bad_type).error().error, ::umb::DecodeError::unknown_message_type);
+
+    const testmessages::umb::AnyMessage empty;
+    CHECK_EQ(testmessages::umb::serialized_size(empty), 0U);
+    CHECK_FALSE(testmessages::umb::encode_any(empty, out));
+}
+
+TEST_CASE("serialized size is kept up to date")
+{
+    testmessages::umb::testmsg msg;
+    const auto check_size = [](const auto& m)
+    {
+        CHECK_EQ(m.serialized_size(), m.to_bytes().size());
+    };
+
+    check_size(msg);
+    msg.set_ffffff(u"grows");
+    check_size(msg);
+    msg.set_ffffff(u"");
+    check_size(msg);
+    msg.set_a_field_with_some_bytes_that_do_some_things({1, 2, 3, 4});
+    check_size(msg);
+    msg.set_one(-1.00000075e-36F);
+    check_size(msg);
+    msg.set_one(1.0F);
+    check_size(msg);
+
+    // Decoded floats are re-encoded, the received strings are not reused.
+    testmessages::umb::testmsg decoded;
+    decoded.set_ffffff(u"overwritten by decoding");
+    REQUIRE(decoded.from_bytes(msg.to_bytes()));
+    check_size(decoded);
+    decoded.set_asd(123.456F);
+    check_size(decoded);
+    decoded.reset();
+    check_size(decoded);
+
+    // Truncated input may leave fields partially decoded.
+    const auto bytes = msg.to_bytes();
+    CHECK_FALSE(decoded.from_bytes(std::span{bytes}.first(bytes.size() - 2)));
+    check_size(decoded);
+
+    testmessages::umb::testmsg moved_to = std::move(msg);
+    check_size(moved_to);
+    check_size(msg); // NOLINT(bugprone-use-after-move)
+
+    inlinemessages::BoundedInlineMessage bim;
+    bim.set_name(u"short");
+    CHECK_THROWS_AS(bim.set_name(std::u16string(17, u'x')), std::invalid_argument);
+    check_size(bim);
+
+    testmessages::umb::DualStringMessage dsm;
+    dsm.set_a(u"first");
+    REQUIRE(dsm.from_bytes(dsm.to_bytes()));
+    check_size(dsm);
+}
+
+TEST_CASE("float setters defer serialization")
+{
+    testmessages::umb::JustAnotherTestMessage msg;
+    msg.set_ByteVarX(1);
+    for (const auto f: {1.0F, -1.00000075e-36F, 0.5F, 1e10F, 0.0F, 2.5F})
+    {
+        msg.set_some_floatVAR(f);
+    }
+    CHECK_EQ(msg.serialized_size(), ::umb::g_header_size + 1 + 3 + 1);
+
+    // Setting again after a size query.
+    msg.set_some_floatVAR(-1.00000075e-36F);
+    msg.set_some_floatVAR(123.25F);
+    const auto bytes = msg.to_bytes();
+    CHECK_EQ(bytes.size(), msg.serialized_size());
+    CHECK_EQ(bytes.size(), ::umb::g_header_size + 1 + 6 + 1);
+
+    testmessages::umb::JustAnotherTestMessage decoded;
+    REQUIRE(decoded.from_bytes(bytes));
+    CHECK_EQ(decoded.some_floatVAR(), 123.25F);
+    CHECK_EQ(decoded, msg);
+}
+
+TEST_CASE("encode_append batches messages into one buffer")
+{
+    testmessages::umb::DualStringMessage dsm;
+    dsm.set_a(u"first");
+    dsm.set_b(u"second");
+    testmessages::umb::GetSomeStuffResp gssr;
+    gssr.set_session(1);
+    gssr.set_userid(2);
+    testmessages::umb::testmsg big;
+    big.set_ffffff(std::u16string(200, u'x'));
+
+    std::vector<::umb::byte> expected;
+    for (const auto& bytes: {dsm.to_bytes(), gssr.to_bytes(), big.to_bytes()})
+    {
+        expected.insert(expected.end(), bytes.cbegin(), bytes.cend());
+    }
+
+    std::vector<::umb::byte> buffer;
+    dsm.encode_append(buffer);
+    CHECK_EQ(buffer.size(), dsm.serialized_size());
+    const testmessages::umb::AnyMessage any = gssr;
+    CHECK(testmessages::umb::encode_append(any, buffer));
+    static_cast<const ::umb::Message&>(big).encode_append(buffer);
+    CHECK_EQ(buffer, expected);
+
+    // Each single part message decodes from its slice of the buffer.
+    auto in = std::span<const ::umb::byte>{buffer};
+    testmessages::umb::DualStringMessage dsm2;
+    REQUIRE(dsm2.from_bytes(in.first(in[0])));
+    CHECK_EQ(dsm2, dsm);
+    in = in.subspan(in[0]);
+    testmessages::umb::GetSomeStuffResp gssr2;
+    REQUIRE(gssr2.from_bytes(in.first(in[0])));
+    CHECK_EQ(gssr2, gssr);
+
+    const auto size_before = buffer.size();
+    CHECK_FALSE(testmessages::umb::encode_append(testmessages::umb::AnyMessage{}, buffer));
+    CHECK_EQ(buffer.size(), size_before);
+}
+
+TEST_CASE("to_packets frames multipart messages")
+{
+    testmessages::umb::testmsg msg;
+    msg.set_ffffff(std::u16string(200, u'x'));
+    msg.set_a_field_with_some_bytes_that_do_some_things(std::vector<::umb::byte>(200, 0xab));
+    const auto encoded = msg.to_bytes();
+    const auto count = ::umb::packet_count(encoded.size());
+    REQUIRE_EQ(count, 3U);
+
+    std::vector<::umb::byte> packets{0xee};
+    msg.to_packets(packets);
+    REQUIRE_EQ(packets.size(), 1 + ::umb::framed_size(encoded.size()));
+    CHECK_EQ(packets[0], 0xee);
+
+    // Reassemble the payload from the framed packets.
+    std::vector<::umb::byte> payload;
+    auto in = std::span<const ::umb::byte>{packets}.subspan(1);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const auto size = in[0];
+        CHECK_EQ(in[1], ::umb::packet_part(i, count));
+        CHECK_EQ(in[2], encoded[2]);
+        CHECK_EQ(in[3], encoded[3]);
+        if (i + 1 < count)
+        {
+            CHECK_EQ(size, ::umb::g_packet_size);
+        }
+        payload.insert(payload.end(), in.begin() + ::umb::g_header_size, in.begin() + size);
+        in = in.subspan(size);
+    }
+    CHECK(in.empty());
+    CHECK_EQ(packets[2], 0);
+    CHECK(std::equal(payload.cbegin(), payload.cend(), encoded.cbegin() + ::umb::g_header_size, encoded.cend()));
+
+    // Scatter-gather frames hold the same bytes.
+    ::umb::PacketFrames frames;
+    std::vector<::umb::byte> gathered{0xee};
+    for (const auto buf: frames.frame(encoded))
+    {
+        gathered.insert(gathered.end(), buf.begin(), buf.end());
+    }
+    CHECK_EQ(gathered, packets);
+
+    // Single part messages are not changed.
+    testmessages::umb::GetSomeStuffResp gssr;
+    std::vector<::umb::byte> single;
+    gssr.to_packets(single);
+    CHECK_EQ(single, gssr.to_bytes());
+    CHECK_EQ(frames.frame(single).size(), 1U);
+}
+
+TEST_CASE("try_from_parts decodes multipart messages in place")
+{
+    testmessages::umb::testmsg msg;
+    msg.set_one(-1.00000075e-36F);
+    msg.set_aa(-123456);
+    msg.set_ffffff(std::u16string(200, u'\u00e4'));
+    msg.set_a_field_with_some_bytes_that_do_some_things(std::vector<::umb::byte>(200, 0xab));
+
+    std::vector<::umb::byte> packets;
+    msg.to_packets(packets);
+    std::vector<std::span<const ::umb::byte>> parts;
+    for (auto in = std::span<const ::umb::byte>{packets}; !in.empty(); in = in.subspan(in[0]))
+    {
+        parts.push_back(in.first(in[0]));
+    }
+    REQUIRE_GT(parts.size(), 2U);
+
+    testmessages::umb::testmsg decoded;
+    REQUIRE(decoded.try_from_parts(parts).has_value());
+    CHECK_EQ(decoded, msg);
+    CHECK_EQ(decoded.serialized_size(), msg.serialized_size());
+
+    // Single part messages are accepted as one part.
+    testmessages::umb::DualStringMessage dsm;
+    dsm.set_a(u"first");
+    dsm.set_b(u"second");
+    const auto dsm_bytes = dsm.to_bytes();
+    const std::array<std::span<const ::umb::byte>, 1> dsm_parts{dsm_bytes};
+    testmessages::umb::DualStringMessage dsm2;
+    REQUIRE(dsm2.try_from_parts(dsm_parts).has_value());
+    CHECK_EQ(dsm2, dsm);
+    CHECK_EQ(dsm2.serialized_size(), dsm_bytes.size());
+
+    // Errors report offsets into the reassembled message.
+    parts.pop_back();
+    const auto error = decoded.try_from_parts(parts).error();
+    CHECK_EQ(error.error, ::umb::DecodeError::not_enough_bytes);
+    CHECK_EQ(error.field, "a_field_with_some_bytes_that_do_some_things");
+    CHECK_EQ(error.offset, msg.serialized_size() - 201);
+    CHECK_EQ(decoded.try_from_parts({}).error().error, ::umb::DecodeError::not_enough_bytes);
+}
+
+TEST_CASE("try_from_parts decodes long strings across part boundaries")
+{
+    // Strings over 127 characters encode to more than g_max_dynamic_size bytes.
+    testmessages::umb::DualStringMessage msg;
+    msg.set_a(std::u16string(200, u'\u00e4'));
+    msg.set_b(std::u16string(::umb::g_max_dynamic_size, u'b'));
+
+    std::vector<::umb::byte> packets;
+    msg.to_packets(packets);
+    std::vector<std::span<const ::umb::byte>> parts;
+    for (auto in = std::span<const ::umb::byte>{packets}; !in.empty(); in = in.subspan(in[0]))
+    {
+        parts.push_back(in.first(in[0]));
+    }
+    // Both strings straddle a part boundary.
+    REQUIRE_EQ(parts.size(), 4U);
+
+    testmessages::umb::DualStringMessage decoded;
+    REQUIRE(decoded.try_from_parts(parts).has_value());
+    CHECK_EQ(decoded, msg);
+}
+
+TEST_CASE("stream parser yields messages across chunk boundaries")
+{
+    testmessages::umb::GetSomeStuffResp gssr;
+    gssr.set_session(1);
+    gssr.set_userid(2);
+    testmessages::umb::DualStringMessage big;
+    big.set_a(std::u16string(200, u'a'));
+
+    std::vector<::umb::byte> stream;
+    gssr.to_packets(stream);
+    big.to_packets(stream);
+    gssr.to_packets(stream);
+
+    // Split inside the first header, then inside the multipart message.
+    ::umb::StreamParser parser;
+    std::vector<uint16_t> types;
+    std::vector<std::size_t> num_parts;
+    const auto on_message = [&](const ::umb::StreamMessage& sm)
+    {
+        types.push_back(sm.type);
+        num_parts.push_back(sm.parts.size());
+    };
+    const auto in = std::span<const ::umb::byte>{stream};
+    CHECK_EQ(parser.push(in.first(2), on_message).value(), 0U);
+    CHECK(parser.in_progress());
+    CHECK_EQ(parser.push(in.subspan(2, 300), on_message).value(), 1U);
+    CHECK(parser.in_progress());
+    CHECK_EQ(parser.push(in.subspan(302), on_message).value(), 2U);
+    CHECK_FALSE(parser.in_progress());
+
+    using testmessages::umb::MessageType;
+    const std::vector<uint16_t> expected_types{
+        static_cast<uint16_t>(MessageType::GetSomeStuffResp),
+        static_cast<uint16_t>(MessageType::DualStringMessage),
+        static_cast<uint16_t>(MessageType::GetSomeStuffResp),
+    };
+    CHECK_EQ(types, expected_types);
+    CHECK_EQ(num_parts, std::vector<std::size_t>{1, 2, 1});
+
+    // Pull mode.
+    parser.feed(stream);
+    const auto first = parser.next();
+    REQUIRE(first.has_value());
+    REQUIRE(first->has_value());
+    CHECK((*first)->is_single_part());
+    testmessages::umb::GetSomeStuffResp gssr2;
+    REQUIRE(gssr2.from_bytes((*first)->parts.front()));
+    CHECK_EQ(gssr2, gssr);
+
+    // Errors.
+    parser.reset();
+    const std::array<::umb::byte, 4> bad_size{2, ::umb::g_part_single_part, 1, 0};
+    CHECK_EQ(parser.push(bad_size, on_message).error(), ::umb::StreamError::invalid_packet_size);
+    parser.reset();
+    const std::array<::umb::byte, 4> bad_part{4, 3, 1, 0};
+    CHECK_EQ(parser.push(bad_part, on_message).error(), ::umb::StreamError::unexpected_part);
+}
+
+TEST_CASE("stream parser copies multipart parts only across chunks")
+{
+    testmessages::umb::DualStringMessage msg;
+    msg.set_a(std::u16string(200, u'a'));
+    msg.set_b(u"b");
+    std::vector<::umb::byte> stream;
+    msg.to_packets(stream);
+    const auto first_part_size = stream.front();
+    REQUIRE_GT(stream.size(), first_part_size + 10U);
+
+    // All parts in one chunk are returned in place.
+    ::umb::StreamParser parser;
+    parser.feed(stream);
+    const auto whole = parser.next();
+    REQUIRE(whole.has_value());
+    REQUIRE(whole->has_value());
+    REQUIRE_EQ((*whole)->parts.size(), 2U);
+    CHECK_EQ((*whole)->parts[0].data() - stream.data(), 0);
+    CHECK_EQ((*whole)->parts[1].data() - stream.data(), first_part_size);
+    testmessages::umb::DualStringMessage decoded;
+    REQUIRE(decoded.try_from_parts((*whole)->parts).has_value());
+    CHECK_EQ(decoded, msg);
+
+    // Split inside the second part. The first part is copied before next()
+    // asks for more bytes, after which the chunk may be overwritten.
+    const auto split = std::ranges::next(stream.cbegin(), first_part_size + 10);
+    std::vector<::umb::byte> first_chunk{stream.cbegin(), split};
+    const std::vector<::umb::byte> second_chunk{split, stream.cend()};
+    parser.feed(first_chunk);
+    const auto more = parser.next();
+    REQUIRE(more.has_value());
+    CHECK_FALSE(more->has_value());
+    std::ranges::fill(first_chunk, ::umb::byte{0});
+
+    parser.feed(second_chunk);
+    const auto joined = parser.next();
+    REQUIRE(joined.has_value());
+    REQUIRE(joined->has_value());
+    testmessages::umb::DualStringMessage decoded2;
+    REQUIRE(decoded2.try_from_parts((*joined)->parts).has_value());
+    CHECK_EQ(decoded2, msg);
+}
+
+TEST_CASE("outgoing queue flush policies")
+{
+    using clock = ::umb::OutgoingQueue::clock;
+    const auto t0 = clock::time_point{} + std::chrono::seconds{1};
+
+    testmessages::umb::GetSomeStuffResp gssr;
+    gssr.set_session(1);
+    std::vector<::umb::byte> expected;
+    gssr.to_packets(expected);
+    gssr.to_packets(expected);
+
+    SUBCASE("immediate")
+    {
+        ::umb::OutgoingQueue queue{{.mode = ::umb::FlushMode::immediate}};
+        CHECK_FALSE(queue.flush_due(t0));
+        queue.push(gssr, t0);
+        CHECK(queue.flush_due(t0));
+        CHECK_EQ(queue.deadline(), clock::time_point::max());
+    }
+
+    SUBCASE("end_of_batch")
+    {
+        ::umb::OutgoingQueue queue;
+        queue.end_batch();
+        CHECK_FALSE(queue.flush_due(t0));
+        queue.push(gssr, t0);
+        queue.push(gssr, t0);
+        CHECK_FALSE(queue.flush_due(t0));
+        queue.end_batch();
+        REQUIRE(queue.flush_due(t0));
+
+        // Messages pushed during a write go to the next flush.
+        const auto bytes = queue.begin_flush();
+        CHECK(std::equal(bytes.begin(), bytes.end(), expected.cbegin(), expected.cend()));
+        CHECK_EQ(queue.pending_bytes(), 0U);
+        queue.push(gssr, t0);
+        CHECK(std::equal(bytes.begin(), bytes.end(), expected.cbegin(), expected.cend()));
+        queue.end_flush();
+        CHECK_FALSE(queue.flush_due(t0));
+        queue.end_batch();
+        CHECK_EQ(queue.begin_flush().size(), expected.size() / 2);
+    }
+
+    SUBCASE("threshold")
+    {
+        ::umb::OutgoingQueue queue{{
+            .mode = ::umb::FlushMode::threshold,
+            .max_bytes = expected.size(),
+            .max_delay = std::chrono::microseconds{500},
+        }};
+        queue.push(gssr, t0);
+        queue.end_batch();
+        CHECK_FALSE(queue.flush_due(t0));
+        CHECK_EQ(queue.deadline(), t0 + std::chrono::microseconds{500});
+        CHECK(queue.flush_due(queue.deadline()));
+        queue.push(gssr, t0 + std::chrono::microseconds{100});
+        CHECK(queue.flush_due(t0));
+        CHECK_EQ(queue.begin_flush().size(), expected.size());
+        CHECK_EQ(queue.deadline(), clock::time_point::max());
+    }
+}
+
+TEST_CASE("router dispatches messages by type")
+{
+    using testmessages::umb::MessageType;
+
+    testmessages::umb::Router<> router;
+    router.on_request<testmessages::umb::GetSomeStuff, testmessages::umb::GetSomeStuffResp>(
+        [](const testmessages::umb::GetSomeStuff& req, testmessages::umb::GetSomeStuffResp& resp)
+        {
+            resp.set_session(req.session());
+            resp.set_userid(7);
+        });
+    std::vector<std::u16string> strings;
+    router.on<testmessages::umb::DualStringMessage>(
+        [&strings](const testmessages::umb::DualStringMessage& msg, ::umb::OutgoingQueue&)
+        {
+            strings.push_back(msg.a());
+            strings.push_back(msg.b());
+        });
+    std::vector<std::pair<uint16_t, ::umb::DecodeError>> errors;
+    router.on_error([&errors](const ::umb::StreamMessage& msg, const ::umb::MessageDecodeError& error,
+                              ::umb::OutgoingQueue&)
+                    {
+                        errors.emplace_back(msg.type, error.error);
+                    });
+
+    const auto dispatch = [&router](const std::vector<::umb::byte>& bytes, ::umb::OutgoingQueue& queue)
+    {
+        const std::array<std::span<const ::umb::byte>, 1> parts{bytes};
+        router(::umb::StreamMessage{
+            .type = static_cast<uint16_t>(bytes[2] | (bytes[3] << 8)),
+            .parts = parts,
+        }, queue);
+    };
+
+    ::umb::OutgoingQueue queue;
+
+    // Replies are framed into the queue.
+    testmessages::umb::GetSomeStuff gss;
+    gss.set_session(42);
+    dispatch(gss.to_bytes(), queue);
+    testmessages::umb::GetSomeStuffResp expected_resp;
+    expected_resp.set_session(42);
+    expected_resp.set_userid(7);
+    std::vector<::umb::byte> expected;
+    expected_resp.to_packets(expected);
+    queue.end_batch();
+    const auto sent = queue.begin_flush();
+    CHECK(std::equal(sent.begin(), sent.end(), expected.cbegin(), expected.cend()));
+    queue.end_flush();
+
+    // Pooled messages are reset between dispatches.
+    testmessages::umb::DualStringMessage dsm;
+    dsm.set_a(u"first");
+    dsm.set_b(u"second");
+    dispatch(dsm.to_bytes(), queue);
+    dispatch(testmessages::umb::DualStringMessage{}.to_bytes(), queue);
+    CHECK_EQ(strings, std::vector<std::u16string>{u"first", u"second", u"", u""});
+    CHECK(errors.empty());
+
+    // Unregistered and unknown types, and decode errors.
+    dispatch(testmessages::umb::JustAnotherTestMessage{}.to_bytes(), queue);
+    auto truncated = gss.to_bytes();
+    truncated.pop_back();
+    truncated[0] = static_cast<::umb::byte>(truncated.size());
+    dispatch(truncated, queue);
+    const std::array<::umb::byte, 4> unknown{4, ::umb::g_part_single_part, 0xff, 0xff};
+    const std::array<std::span<const ::umb::byte>, 1> unknown_parts{unknown};
+    router(::umb::StreamMessage{.type = 0xffff, .parts = unknown_parts}, queue);
+
+    const std::vector<std::pair<uint16_t, ::umb::DecodeError>> expected_errors{
+        {static_cast<uint16_t>(MessageType::JustAnotherTestMessage), ::umb::DecodeError::unhandled_message_type},
+        {static_cast<uint16_t>(MessageType::GetSomeStuff), ::umb::DecodeError::not_enough_bytes},
+        {0xffff, ::umb::DecodeError::unknown_message_type},
+    };
+    CHECK_EQ(errors, expected_errors);
+    CHECK_EQ(queue.pending_bytes(), 0U);
+}
+
+TEST_CASE("tracer records sampled messages")
+{
+    testmessages::umb::GetSomeStuffResp gssr;
+    gssr.set_session(5);
+    gssr.set_userid(6);
+    const auto bytes = gssr.to_bytes();
+    const std::array<std::span<const ::umb::byte>, 1> parts{bytes};
+    const ::umb::StreamMessage sm{
+        .type = static_cast<uint16_t>(testmessages::umb::MessageType::GetSomeStuffResp),
+        .parts = parts,
+    };
+
+    // 6 sampled messages, 2 of which do not fit before a drain.
+    ::umb::Tracer tracer{{.sample_every = 2, .snapshot_bytes = ::umb::g_packet_size, .ring_capacity = 4}};
+    for (int i = 0; i < 12; ++i)
+    {
+        tracer.record(1, sm);
+    }
+    CHECK_EQ(tracer.dropped(), 2U);
+    std::jthread([&tracer, &sm]
+                 {
+                     tracer.record(2, sm);
+                     tracer.record(2, sm);
+                 }).join();
+
+    std::stringstream trace;
+    ::umb::write_trace_header(trace);
+    CHECK_EQ(tracer.drain(trace), 5U);
+    CHECK_EQ(tracer.drain(trace), 0U);
+
+    std::vector<uint64_t> connection_ids;
+    const auto result = ::umb::read_trace(trace, [&](const ::umb::TraceRecord& rec)
+    {
+        connection_ids.push_back(rec.connection_id);
+        CHECK_EQ(rec.type, sm.type);
+        CHECK_EQ(rec.size, bytes.size());
+        REQUIRE(rec.is_complete());
+        testmessages::umb::GetSomeStuffResp decoded;
+        REQUIRE(decoded.try_from_bytes(rec.snapshot_bytes()).has_value());
+        CHECK_EQ(decoded, gssr);
+    });
+    REQUIRE(result.has_value());
+    CHECK_EQ(*result, 5U);
+    CHECK_EQ(connection_ids, std::vector<uint64_t>{1, 1, 1, 1, 2});
+
+    // Header fields only.
+    ::umb::Tracer headers_only;
+    headers_only.record(3, sm);
+    std::stringstream truncated;
+    ::umb::write_trace_header(truncated);
+    headers_only.drain(truncated);
+    auto str = truncated.str();
+    CHECK_EQ(str.size(), sizeof(::umb::g_trace_magic) + sizeof(::umb::g_trace_version)
+                         + ::umb::g_trace_record_header_size);
+    str.pop_back();
+    truncated.str(str);
+    CHECK_EQ(::umb::read_trace(truncated, [](const auto&) {}).error(), ::umb::TraceError::truncated_record);
+
+    std::stringstream not_a_trace{"UMBTRACX"};
+    CHECK_EQ(::umb::read_trace(not_a_trace, [](const auto&) {}).error(), ::umb::TraceError::invalid_header);
+}
@@ -0,0 +1,500 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Loopback tests of the transport backends.
+
+#ifndef __JETBRAINS_IDE__
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#endif
+
+#include "umb/umb.hpp"
+
+#if UMB_WINDOWS
+
+// Silence "Please define _WIN32_WINNT or _WIN32_WINDOWS appropriately".
+#include <SDKDDKVer.h>
+
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/asio/write.hpp>
+
+#include "umb/net/connection.hpp"
+#include "umb/net/server.hpp"
+#include "umb/net/uring_server.hpp"
+
+#include "TestMessages.umb.hpp"
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+// Bounds every blocking step so a lost reply fails the test instead of hanging it.
+constexpr auto g_timeout = std::chrono::seconds{10};
+
+// Decode every message and queue it back.
+void echo_message(const ::umb::StreamMessage& sm, ::umb::OutgoingQueue& queue)
+{
+    const auto msg = testmessages::umb::thread_message_pool().acquire(
+        static_cast<testmessages::umb::MessageType>(sm.type));
+    if (msg && msg->try_from_parts(sm.parts))
+    {
+        queue.push(*msg);
+    }
+}
+
+std::vector<::umb::byte> make_request(uint64_t session)
+{
+    testmessages::umb::GetSomeStuffResp msg;
+    msg.set_session(session);
+    msg.set_userid(2);
+    return msg.to_bytes();
+}
+
+// Blocking client with a timeout on every read.
+class Client
+{
+public:
+    explicit Client(const tcp::endpoint& endpoint)
+    {
+        m_socket.connect(endpoint);
+    }
+
+    void write(const std::vector<::umb::byte>& bytes)
+    {
+        boost::asio::write(m_socket, boost::asio::buffer(bytes));
+    }
+
+    // Read \size bytes, nullopt if the connection closed or timed out first.
+    std::optional<std::vector<::umb::byte>> read(std::size_t size)
+    {
+        std::vector<::umb::byte> bytes(size);
+        boost::system::error_code result = boost::asio::error::timed_out;
+        boost::asio::async_read(m_socket, boost::asio::buffer(bytes),
+                                [&result](const boost::system::error_code& ec, std::size_t)
+                                {
+                                    result = ec;
+                                });
+        run();
+        if (result)
+        {
+            return std::nullopt;
+        }
+        return bytes;
+    }
+
+    // True if the server closes the connection without sending more.
+    bool read_eof()
+    {
+        ::umb::byte byte{};
+        boost::system::error_code result = boost::asio::error::timed_out;
+        m_socket.async_read_some(boost::asio::buffer(&byte, 1),
+                                 [&result](const boost::system::error_code& ec, std::size_t)
+                                 {
+                                     result = ec;
+                                 });
+        run();
+        return result == boost::asio::error::eof;
+    }
+
+    void shutdown_send()
+    {
+        m_socket.shutdown(tcp::socket::shutdown_send);
+    }
+
+    // Close with a reset instead of a FIN.
+    void abort()
+    {
+        m_socket.set_option(tcp::socket::linger(true, 0));
+        m_socket.close();
+    }
+
+private:
+    void run()
+    {
+        m_io.restart();
+        if (m_io.run_for(g_timeout) == 0)
+        {
+            // Timed out, cancel the read and wait for its handler.
+            m_socket.cancel();
+            m_io.restart();
+            m_io.run();
+        }
+    }
+
+    boost::asio::io_context m_io;
+    tcp::socket m_socket{m_io};
+};
+
+// Accepts one connection and serves it with serve_messages() on a background thread.
+class ServeOneConnection
+{
+public:
+    explicit ServeOneConnection(::umb::FlushPolicy policy)
+    {
+        m_reason = boost::asio::co_spawn(m_io, serve(policy), boost::asio::use_future);
+        m_thread = std::jthread([this]
+                                {
+                                    m_io.run();
+                                });
+    }
+
+    ~ServeOneConnection()
+    {
+        m_io.stop();
+    }
+
+    [[nodiscard]] tcp::endpoint endpoint() const
+    {
+        return m_acceptor.local_endpoint();
+    }
+
+    // Wait for serve_messages() to return.
+    std::optional<::umb::net::CloseReason> close_reason()
+    {
+        if (m_reason.wait_for(g_timeout) != std::future_status::ready)
+        {
+            return std::nullopt;
+        }
+        return m_reason.get();
+    }
+
+private:
+    boost::asio::awaitable<::umb::net::CloseReason> serve(::umb::FlushPolicy policy)
+    {
+        auto socket = co_await m_acceptor.async_accept(boost::asio::use_awaitable);
+        co_return co_await ::umb::net::serve_messages(std::move(socket), echo_message, policy);
+    }
+
+    boost::asio::io_context m_io;
+    tcp::acceptor m_acceptor{m_io, {boost::asio::ip::address_v4::loopback(), 0}};
+    std::future<::umb::net::CloseReason> m_reason;
+    std::jthread m_thread;
+};
+
+} // namespace
+
+TEST_CASE("serve_messages sends a threshold reply at its deadline")
+{
+    // Far above the reply size, so only the deadline can flush it.
+    ServeOneConnection server{{
+        .mode = ::umb::FlushMode::threshold,
+        .max_bytes = 64 * 1024,
+        .max_delay = std::chrono::milliseconds{10},
+    }};
+    Client client{server.endpoint()};
+
+    const auto request = make_request(1);
+    client.write(request);
+    const auto reply = client.read(request.size());
+    REQUIRE(reply.has_value());
+    CHECK_EQ(*reply, request);
+
+    client.shutdown_send();
+    CHECK(client.read_eof());
+    const auto reason = server.close_reason();
+    REQUIRE(reason.has_value());
+    CHECK(reason->error == boost::asio::error::eof);
+    CHECK_FALSE(reason->stream_error.has_value());
+}
+
+TEST_CASE("serve_messages sends queued replies before closing")
+{
+    constexpr std::size_t num_requests = 1000;
+
+    for (const auto mode: {::umb::FlushMode::immediate, ::umb::FlushMode::end_of_batch, ::umb::FlushMode::threshold})
+    {
+        CAPTURE(static_cast<int>(mode));
+        // Threshold replies are only flushed by the drain on close.
+        ServeOneConnection server{{
+            .mode = mode,
+            .max_bytes = 64 * 1024,
+            .max_delay = std::chrono::hours{1},
+        }};
+        Client client{server.endpoint()};
+
+        std::vector<::umb::byte> requests;
+        for (std::size_t i = 0; i < num_requests; ++i)
+        {
+            const auto request = make_request(i);
+            requests.insert(requests.cend(), request.cbegin(), request.cend());
+        }
+        client.write(requests);
+        client.shutdown_send();
+
+        const auto replies = client.read(requests.size());
+        REQUIRE(replies.has_value());
+        CHECK_EQ(*replies, requests);
+        CHECK(client.read_eof());
+        const auto reason = server.close_reason();
+        REQUIRE(reason.has_value());
+        CHECK(reason->error == boost::asio::error::eof);
+    }
+}
+
+TEST_CASE("serve_messages replies to valid messages before a stream error")
+{
+    ServeOneConnection server{{}};
+    Client client{server.endpoint()};
+
+    auto bytes = make_request(1);
+    const auto request = bytes;
+    // Packet size field smaller than the packet header.
+    bytes.insert(bytes.cend(), {2, 0, 0, 0});
+    client.write(bytes);
+
+    const auto reply = client.read(request.size());
+    REQUIRE(reply.has_value());
+    CHECK_EQ(*reply, request);
+    CHECK(client.read_eof());
+    const auto reason = server.close_reason();
+    REQUIRE(reason.has_value());
+    CHECK(reason->stream_error.has_value());
+}
+
+TEST_CASE("server echoes messages in every accept mode")
+{
+    std::vector<::umb::net::AcceptMode> modes{::umb::net::AcceptMode::round_robin};
+#if UMB_NET_HAS_REUSEPORT
+    modes.push_back(::umb::net::AcceptMode::reuse_port);
+#endif
+
+    for (const auto mode: modes)
+    {
+        CAPTURE(static_cast<int>(mode));
+        ::umb::net::Server server{
+            {
+                .endpoint = {boost::asio::ip::address_v4::loopback(), 0},
+                .num_threads = 4,
+                .accept_mode = mode,
+            },
+            [](tcp::socket socket)
+            {
+                return ::umb::net::serve_messages(std::move(socket), echo_message);
+            }};
+        server.start();
+
+        // More connections than workers, so round-robin hands some to every worker.
+        for (uint64_t i = 0; i < 16; ++i)
+        {
+            Client client{server.local_endpoint()};
+            const auto request = make_request(i);
+            client.write(request);
+            const auto reply = client.read(request.size());
+            REQUIRE(reply.has_value());
+            CHECK_EQ(*reply, request);
+        }
+
+        server.stop();
+        CHECK_FALSE(server.error());
+    }
+}
+
+TEST_CASE("server reports an exception thrown by the handler")
+{
+    ::umb::net::Server server{
+        {
+            .endpoint = {boost::asio::ip::address_v4::loopback(), 0},
+            .num_threads = 2,
+        },
+        [](tcp::socket) -> boost::asio::awaitable<void>
+        {
+            throw std::runtime_error("handler failed");
+        }};
+    server.start();
+    Client client{server.local_endpoint()};
+
+    const auto give_up = std::chrono::steady_clock::now() + g_timeout;
+    while (!server.error() && std::chrono::steady_clock::now() < give_up)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    server.stop();
+    REQUIRE(server.error());
+    CHECK_THROWS_AS(std::rethrow_exception(server.error()), std::runtime_error);
+}
+
+#if UMB_NET_HAS_IO_URING
+
+namespace
+{
+
+::umb::net::UringServerOptions make_uring_options(std::size_t num_threads, ::umb::FlushPolicy policy)
+{
+    return {
+        .server = {
+            .endpoint = {boost::asio::ip::address_v4::loopback(), 0},
+            .num_threads = num_threads,
+        },
+        .flush_policy = policy,
+        // Small buffers, so larger writes span several receives.
+        .num_buffers = 16,
+        .buffer_size = 1024,
+    };
+}
+
+// Replies to every message with \copies copies of it.
+struct RepeatEcho
+{
+    std::size_t copies{1};
+
+    void operator()(const ::umb::StreamMessage& sm, ::umb::OutgoingQueue& queue) const
+    {
+        const auto msg = testmessages::umb::thread_message_pool().acquire(
+            static_cast<testmessages::umb::MessageType>(sm.type));
+        if (msg && msg->try_from_parts(sm.parts))
+        {
+            for (std::size_t i = 0; i < copies; ++i)
+            {
+                queue.push(*msg);
+            }
+        }
+    }
+};
+
+} // namespace
+
+TEST_CASE("uring server sends the rest of a short send")
+{
+    const auto request = make_request(1);
+    // Far more than the socket buffers hold. The client waits before
+    // reading, so the kernel takes only part of the reply per send.
+    const std::size_t copies = 8 * 1024 * 1024 / request.size();
+    ::umb::net::UringServer server{make_uring_options(1, {}), RepeatEcho{copies}};
+    server.start();
+    Client client{server.local_endpoint()};
+
+    std::vector<::umb::byte> expected;
+    for (std::size_t i = 0; i < copies; ++i)
+    {
+        expected.insert(expected.cend(), request.cbegin(), request.cend());
+    }
+    client.write(request);
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    const auto replies = client.read(expected.size());
+    REQUIRE(replies.has_value());
+    CHECK(*replies == expected);
+
+    server.stop();
+    CHECK_FALSE(server.error());
+}
+
+TEST_CASE("uring server flushes threshold replies of idle connections")
+{
+    // One worker, so every connection is in the same deadline list.
+    ::umb::net::UringServer server{
+        make_uring_options(1, {
+            .mode = ::umb::FlushMode::threshold,
+            .max_bytes = 64 * 1024,
+            .max_delay = std::chrono::milliseconds{10},
+        }),
+        echo_message};
+    server.start();
+
+    std::vector<std::unique_ptr<Client>> clients;
+    for (uint64_t i = 0; i < 8; ++i)
+    {
+        clients.push_back(std::make_unique<Client>(server.local_endpoint()));
+        clients.back()->write(make_request(i));
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    // Reset while their replies wait for the deadline, which unlinks them from the middle of the list.
+    clients[3]->abort();
+    clients[5]->abort();
+
+    for (uint64_t i = 0; i < clients.size(); ++i)
+    {
+        if (i == 3 || i == 5)
+        {
+            continue;
+        }
+        CAPTURE(i);
+        const auto request = make_request(i);
+        const auto reply = clients[i]->read(request.size());
+        REQUIRE(reply.has_value());
+        CHECK_EQ(*reply, request);
+    }
+
+    server.stop();
+    CHECK_FALSE(server.error());
+}
+
+TEST_CASE("uring server releases closed connections")
+{
+    ::umb::net::UringServer server{make_uring_options(1, {}), echo_message};
+    server.start();
+
+    // Closed by a FIN, a reset and a malformed packet in turn.
+    for (uint64_t i = 0; i < 300; ++i)
+    {
+        CAPTURE(i);
+        Client client{server.local_endpoint()};
+        const auto request = make_request(i);
+        switch (i % 3)
+        {
+            case 0:
+                client.write(request);
+                client.shutdown_send();
+                CHECK_EQ(client.read(request.size()), request);
+                CHECK(client.read_eof());
+                break;
+            case 1:
+                client.write(request);
+                client.abort();
+                break;
+            default:
+            {
+                auto bytes = request;
+                bytes.insert(bytes.cend(), {2, 0, 0, 0});
+                client.write(bytes);
+                CHECK_EQ(client.read(request.size()), request);
+                CHECK(client.read_eof());
+                break;
+            }
+        }
+    }
+
+    // Still serving after the worker has released the closed connections.
+    Client client{server.local_endpoint()};
+    const auto request = make_request(1);
+    client.write(request);
+    CHECK_EQ(client.read(request.size()), request);
+
+    server.stop();
+    CHECK_FALSE(server.error());
+}
+
+#endif // UMB_NET_HAS_IO_URING
@@ -21,11 +21,80 @@
 
 #include <doctest/doctest.h>
 
+#include <algorithm>
 #include <format>
 #include <iostream>
+#include <random>
+#include <vector>
 
 #include "umb/umb.hpp"
 
+#include "TestMessages.umb.hpp"
+
+TEST_CASE("stream parser with randomly chunked input")
+{
+    std::mt19937 rng{1234};
+    std::vector<std::vector<::umb::byte>> sent;
+    std::vector<::umb::byte> stream;
+    for (int i = 0; i < 500; ++i)
+    {
+        if (rng() % 2 == 0)
+        {
+            testmessages::umb::DualStringMessage msg;
+            // Long strings are sent as multipart messages.
+            msg.set_a(std::u16string(rng() % 300, static_cast<char16_t>(rng())));
+            msg.set_b(std::u16string(rng() % 50, static_cast<char16_t>(rng())));
+            sent.push_back(msg.to_bytes());
+            msg.to_packets(stream);
+        }
+        else
+        {
+            testmessages::umb::GetSomeStuffResp msg;
+            msg.set_session(static_cast<int32_t>(rng()));
+            msg.set_userid(static_cast<int32_t>(rng()));
+            sent.push_back(msg.to_bytes());
+            msg.to_packets(stream);
+        }
+    }
+
+    ::umb::StreamParser parser;
+    std::size_t received = 0;
+    auto in = std::span<const ::umb::byte>{stream};
+    while (!in.empty())
+    {
+        const auto chunk = in.first(std::min<std::size_t>(in.size(), rng() % 600 + 1));
+        in = in.subspan(chunk.size());
+        const auto result = parser.push(chunk, [&](const ::umb::StreamMessage& sm)
+        {
+            REQUIRE_LT(received, sent.size());
+            auto msg = testmessages::umb::thread_message_pool().acquire(
+                static_cast<testmessages::umb::MessageType>(sm.type));
+            REQUIRE(msg);
+            REQUIRE(msg->try_from_parts(sm.parts).has_value());
+            CHECK_EQ(msg->to_bytes(), sent[received]);
+            ++received;
+        });
+        REQUIRE(result.has_value());
+    }
+    CHECK_EQ(received, sent.size());
+    CHECK_FALSE(parser.in_progress());
+
+    // Random garbage must not crash the parser.
+    for (int i = 0; i < 1000; ++i)
+    {
+        std::vector<::umb::byte> garbage(rng() % 1024);
+        std::generate(garbage.begin(), garbage.end(), [&rng]()
+        {
+            return static_cast<::umb::byte>(rng());
+        });
+        ::umb::StreamParser garbage_parser;
+        static_cast<void>(garbage_parser.push(garbage, [](const ::umb::StreamMessage& sm)
+        {
+            CHECK_FALSE(sm.parts.empty());
+        }));
+    }
+}
+
 // Only possible with reflection.
 // TODO: disabled entirely on Windows due to a compiler bug.
 // https://developercommunity.visualstudio.com/t/Capture-of-constexpr-variable-not-workin/10190629?sort=active&topics=windows+10.0
@@ -45,7 +114,6 @@
 #include <unicode/ustream.h>
 
 #include "MoreMessage.umb.hpp"
-#include "TestMessages.umb.hpp"
 
 // TODO: include this in top level CMake as an option.
 // Warning: going too high will hit the stack limit.
@@ -31,29 +31,33 @@
 
 #endif
 
-#include <expected>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <exception>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string_view>
+#include <thread>
 
-#include <boost/asio/as_tuple.hpp>
-#include <boost/asio/co_spawn.hpp>
-#include <boost/asio/detached.hpp>
-#include <boost/asio/experimental/coro.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
-#include <boost/asio/read.hpp>
 #include <boost/asio/signal_set.hpp>
-#include <boost/asio/write.hpp>
-
-#include <unicode/unistr.h>
-#include <unicode/ustring.h>
 
 #include "spdlog/async.h"
 #include "spdlog/sinks/rotating_file_sink.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/spdlog.h"
 
+#include "umb/net/connection.hpp"
+#include "umb/net/server.hpp"
+#include "umb/net/uring_server.hpp"
+#include "umb/trace.hpp"
+
 #include "TestMessages.umb.hpp"
 
 namespace
@@ -61,12 +65,7 @@ namespace
 
 using boost::asio::ip::tcp;
 using boost::asio::awaitable;
-using boost::asio::co_spawn;
-using boost::asio::detached;
 using boost::asio::use_awaitable;
-using boost::asio::deferred;
-using boost::asio::as_tuple;
-namespace this_coro = boost::asio::this_coro;
 
 #if defined(BOOST_ASIO_ENABLE_HANDLER_TRACKING)
 # define use_awaitable \
@@ -75,557 +74,217 @@ namespace this_coro = boost::asio::this_coro;
 
 std::shared_ptr<spdlog::async_logger> g_logger;
 
-std::string bytes_to_string(const std::span<const ::umb::byte> bytes, size_t num_to_take)
-{
-    if (num_to_take > bytes.size())
-    {
-        throw std::runtime_error(std::format(
-            "num_to_take larger than array ({} > {})", num_to_take, bytes.size()));
-    }
+// Outgoing packet flush policy of all connections. Set from the
+// command line: immediate, end_of_batch or threshold.
+umb::FlushPolicy g_flush_policy{};
 
-    std::stringstream ss;
-    ss << "[";
-    for (size_t i = 0; i < num_to_take; ++i)
-    {
-        const auto byte = bytes[i];
-        // ss << std::format("{:x},", +byte);
-        ss << std::format("{},", +byte);
-    }
-    ss << "]";
-    return ss.str();
-}
+// Size of the per-connection receive buffer. Every read takes as
+// many bytes as the socket has available, up to this size.
+constexpr std::size_t g_recv_buffer_size = 64 * 1024;
 
-enum class Error
-{
-    invalid_size,
-    boost_error,
-    todo,
-};
+// Received messages are traced in binary into umb_echo_server.trace,
+// decode it with umb_trace_decode. Sampling is set from the command line.
+constexpr auto g_trace_file = "umb_echo_server.trace";
+constexpr auto g_trace_drain_interval = std::chrono::milliseconds{100};
+std::unique_ptr<umb::Tracer> g_tracer;
 
-// TODO: should we generate something like this for all generated message
-//   "packages"? E.g. testmessages::umb::MessageHeader?
-struct Header
-{
-    umb::byte size{};
-    umb::byte part{};
-    testmessages::umb::MessageType type{};
-};
+std::atomic<uint64_t> g_next_connection_id{1};
 
-void print_header(const Header& header)
+// Decode a received message and queue it to be sent back.
+void handle_message(uint64_t connection_id, const umb::StreamMessage& received, umb::OutgoingQueue& queue)
 {
-    g_logger->info("size: {}", header.size);
-    g_logger->info("part: {}", header.part);
-
-#ifdef UMB_INCLUDE_META
-    const auto mt_str = testmessages::umb::meta::to_string(header.type);
-#else
-    const auto mt_str = std::to_string(static_cast<uint16_t>(header.type));
-#endif
-
-    g_logger->info("type: {}", mt_str);
-}
+    g_tracer->record(connection_id, received);
 
-// TODO: unify error codes!
-//  https://www.boost.org/doc/libs/1_76_0/libs/system/doc/html/system.html
-boost::asio::experimental::coro<void() noexcept, std::expected<Header, Error>>
-read_header(
-    tcp::socket& socket,
-    std::array<umb::byte, umb::g_packet_size>& data)
-{
-    g_logger->info("reading {} bytes", umb::g_header_size);
-    const auto [ec, num_read] = co_await boost::asio::async_read(
-        socket,
-        boost::asio::buffer(data),
-        boost::asio::transfer_exactly(umb::g_header_size),
-        as_tuple(deferred));
-
-    if (ec != std::errc())
+    // Recycled, so a long-lived connection does not allocate messages.
+    const auto msg = testmessages::umb::thread_message_pool().acquire(
+        static_cast<testmessages::umb::MessageType>(received.type));
+    if (!msg)
     {
-        co_return std::unexpected(Error::boost_error);
+        g_logger->error("connection {}: invalid MessageType {}", connection_id, received.type);
+        return;
     }
 
-    const auto size = data[0];
-
-    if (size == 0)
-    {
-        co_return std::unexpected(Error::invalid_size);
-    }
-
-    const auto part = data[1];
-    const auto type = static_cast<testmessages::umb::MessageType>(
-        data[2] | (data[3] << 8));
-
-    const Header hdr = {
-        .size = size,
-        .part = part,
-        .type = type,
-    };
-    co_return hdr;
-}
-
-boost::asio::experimental::coro<void() noexcept, std::expected<void, Error>>
-handle_single_part_msg(
-    tcp::socket& socket,
-    size_t size,
-    testmessages::umb::MessageType type,
-    std::array<umb::byte, umb::g_packet_size>& data)
-{
-    // TODO: pass in span into this function, with the header bytes already
-    //   assumed to be "skipped" by the caller?
-    const auto read_num = size - umb::g_header_size;
-    auto d = std::span{data.begin() + umb::g_header_size, data.size() - umb::g_header_size};
-    const auto [ec, num_read] = co_await boost::asio::async_read(
-        socket,
-        boost::asio::buffer(d),
-        boost::asio::transfer_exactly(read_num),
-        as_tuple(deferred));
-
-    const auto payload = std::span<umb::byte>{data.data(), size};
-    std::shared_ptr<umb::Message> msg;
-
-    switch (type)
+    if (const auto result = msg->try_from_parts(received.parts); !result)
     {
-        case testmessages::umb::MessageType::GetSomeStuff:
-            msg = std::make_shared<testmessages::umb::GetSomeStuff>();
-            msg->from_bytes(payload);
-            break;
-        case testmessages::umb::MessageType::GetSomeStuffResp:
-            msg = std::make_shared<testmessages::umb::GetSomeStuffResp>();
-            msg->from_bytes(payload);
-            break;
-        case testmessages::umb::MessageType::JustAnotherTestMessage:
-            msg = std::make_shared<testmessages::umb::JustAnotherTestMessage>();
-            msg->from_bytes(payload);
-            break;
-        case testmessages::umb::MessageType::testmsg:
-            msg = std::make_shared<testmessages::umb::testmsg>();
-            msg->from_bytes(payload);
-            break;
-        case testmessages::umb::MessageType::BoolPackingMessage:
-            msg = std::make_shared<testmessages::umb::BoolPackingMessage>();
-            msg->from_bytes(payload);
-            break;
-        case testmessages::umb::MessageType::STATIC_BoolPackingMessage:
-            msg = std::make_shared<testmessages::umb::STATIC_BoolPackingMessage>();
-            msg->from_bytes(payload);
-            break;
-        case testmessages::umb::MessageType::MultiStringMessage:
-            msg = std::make_shared<testmessages::umb::MultiStringMessage>();
-            msg->from_bytes(payload);
-            break;
-        case testmessages::umb::MessageType::DualStringMessage:
-            msg = std::make_shared<testmessages::umb::DualStringMessage>();
-            msg->from_bytes(payload);
-            break;
-
-        case testmessages::umb::MessageType::None:
-        default:
-            /*
-            throw std::runtime_error(
-                std::format("invalid MessageType: {}",
-                            std::to_string(static_cast<uint16_t>(type))));
-            */
-            co_return std::unexpected(Error::todo);
+        g_logger->error("connection {}: try_from_parts failed for MessageType {}: "
+                        "error: {}, field: {}, offset: {}",
+                        connection_id, received.type, static_cast<int>(result.error().error),
+                        result.error().field, result.error().offset);
     }
 
-    const auto bytes_out = msg->to_bytes();
-
-    // TODO: check ec.
-    g_logger->info("sending {} bytes", bytes_out.size());
-    co_await async_write(
-        socket,
-        boost::asio::buffer(bytes_out),
-        deferred);
+    queue.push(*msg);
 }
 
-boost::asio::experimental::coro<void() noexcept, std::expected<void, Error>>
-handle_multi_part_msg(
-    tcp::socket& socket,
-    size_t size,
-    testmessages::umb::MessageType type,
-    std::array<umb::byte, umb::g_packet_size>& data)
+// MessageHandler of one connection. Every connection gets its own copy,
+// which takes a connection id on its first message.
+struct EchoHandler
 {
-    // TODO: use asio::streambuf?
-
-    std::vector<umb::byte> msg_buf;
-    umb::byte part = 0;
-    umb::byte next_part;
-
-    // TODO: pass in span into this function, with the header bytes already
-    //   assumed to be "skipped" by the caller?
-    auto read_num = size - umb::g_header_size;
-    auto d = std::span{data.begin() + umb::g_header_size, data.size() - umb::g_header_size};
-    g_logger->info("reading {} bytes", read_num);
-    const auto [read_ec, num_read_actual] = co_await boost::asio::async_read(
-        socket,
-        boost::asio::buffer(d),
-        boost::asio::transfer_exactly(read_num),
-        as_tuple(deferred));
-
-    if (read_ec != std::errc())
-    {
-        g_logger->error("async_read failed: {}, num_read_actual: {}",
-                        read_ec.message(), read_num);
-    }
+    uint64_t connection_id{0};
 
-    msg_buf.reserve(read_num);
-    msg_buf.insert(
-        msg_buf.end(),
-        data.cbegin(),
-        // Header bytes are also included in the first part.
-        data.cbegin() + static_cast<std::ptrdiff_t>(read_num) + umb::g_header_size);
-
-    next_part = part + 1;
-    while (part != umb::g_part_multi_part_end)
+    void operator()(const umb::StreamMessage& received, umb::OutgoingQueue& queue)
     {
-        const auto result = co_await read_header(socket, data);
-        if (!result.has_value())
+        if (connection_id == 0)
         {
-            const auto err = result.error();
-            g_logger->error("error: {}", static_cast<int>(err));
-            // TODO
-            co_return std::unexpected(err);
+            connection_id = g_next_connection_id.fetch_add(1, std::memory_order_relaxed);
         }
+        handle_message(connection_id, received, queue);
+    }
+};
 
-        const auto header = *result;
-        print_header(header);
-
-        if (header.part != next_part && header.part != umb::g_part_multi_part_end)
-        {
-            // TODO
-            g_logger->error("expected part {}, got {}", next_part, header.part);
-            co_return std::unexpected(Error::todo);
-        }
+// TODO: close connection on bad data, error, etc.?
+awaitable<void> echo(tcp::socket socket)
+{
+    try
+    {
+        const EchoHandler handler{.connection_id = g_next_connection_id.fetch_add(1, std::memory_order_relaxed)};
+        g_logger->info("connection {}: {}:{}",
+                       handler.connection_id,
+                       socket.remote_endpoint().address().to_string(),
+                       socket.remote_endpoint().port());
 
-        if (header.type != type)
+        const auto reason = co_await umb::net::serve_messages(
+            std::move(socket), handler, g_flush_policy, g_recv_buffer_size);
+        if (reason.stream_error)
         {
-            // TODO
-            g_logger->error("expected type {}, got {}",
-                            static_cast<uint64_t>(type),
-                            static_cast<uint16_t>(header.type));
-            co_return std::unexpected(Error::todo);
+            g_logger->error("connection {}: stream error: {}, connection closed",
+                            handler.connection_id, static_cast<int>(*reason.stream_error));
         }
-
-        read_num = header.size - umb::g_header_size;
-        g_logger->info("reading {} bytes", read_num);
-        const auto [ec, num_read] = co_await boost::asio::async_read(
-            socket,
-            boost::asio::buffer(data),
-            boost::asio::transfer_exactly(read_num),
-            as_tuple(deferred));
-
-        if (ec != std::errc())
+        else
         {
-            g_logger->error("async_read failed: {}, num_read: {}",
-                            ec.message(), num_read);
+            g_logger->info("connection {} closed: {}", handler.connection_id, reason.error.message());
         }
-
-        msg_buf.reserve(msg_buf.size() + read_num);
-        msg_buf.insert(
-            msg_buf.end(),
-            data.cbegin(),
-            data.cbegin() + static_cast<std::ptrdiff_t>(read_num));
-
-        part = header.part;
-        next_part = part + 1;
     }
-
-    g_logger->info("received msg_buf: {}", bytes_to_string(msg_buf, msg_buf.size()));
-
-    std::shared_ptr<umb::Message> msg;
-    bool ok = false;
-
-    switch (type)
+    catch (const std::exception& e)
     {
-        case testmessages::umb::MessageType::GetSomeStuff:
-            msg = std::make_shared<testmessages::umb::GetSomeStuff>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-        case testmessages::umb::MessageType::GetSomeStuffResp:
-            msg = std::make_shared<testmessages::umb::GetSomeStuffResp>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-        case testmessages::umb::MessageType::JustAnotherTestMessage:
-            msg = std::make_shared<testmessages::umb::JustAnotherTestMessage>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-        case testmessages::umb::MessageType::testmsg:
-            msg = std::make_shared<testmessages::umb::testmsg>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-        case testmessages::umb::MessageType::BoolPackingMessage:
-            msg = std::make_shared<testmessages::umb::BoolPackingMessage>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-        case testmessages::umb::MessageType::STATIC_BoolPackingMessage:
-            msg = std::make_shared<testmessages::umb::STATIC_BoolPackingMessage>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-        case testmessages::umb::MessageType::MultiStringMessage:
-            msg = std::make_shared<testmessages::umb::MultiStringMessage>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-        case testmessages::umb::MessageType::DualStringMessage:
-            msg = std::make_shared<testmessages::umb::DualStringMessage>();
-            ok = msg->from_bytes(msg_buf);
-            break;
-
-        case testmessages::umb::MessageType::None:
-        default:
-            // TODO
-            co_return std::unexpected(Error::todo);
-//            throw std::runtime_error(
-//                std::format("invalid MessageType: {}",
-//                            std::to_string(static_cast<uint16_t>(type))));
+        g_logger->error("echo error: {}", e.what());
     }
+}
 
-    if (!ok)
+std::optional<umb::FlushMode> parse_flush_mode(const std::string_view arg)
+{
+    if (arg == "immediate")
     {
-        g_logger->error("umb_echo_server ERROR: msg->from_bytes failed for MessageType {}",
-                        static_cast<int>(type));
+        return umb::FlushMode::immediate;
     }
-
-    // TODO: what the fuck is going on here?
-    // std::wcout << std::format(L"*** received message: {} ***\n\n\n", msg->to_string()) << std::endl;
-    // std::wcout << std::endl;
-    // std::cout << std::endl;
-
-    const auto log_msg = std::format(L"*** received message: {} ***\n\n\n", msg->to_string());
-#if UMB_WINDOWS
-    const auto log_msg_icu = icu::UnicodeString(
-        log_msg.c_str(),
-        static_cast<int32_t>(log_msg.size()));
-    std::string log_msg_str;
-    log_msg_icu.toUTF8String(log_msg_str);
-#else
-    // TODO: this might not work properly. Have to actually test the server on Linux!
-    UErrorCode u_err = U_ZERO_ERROR;
-    const UChar* size_needed_result = u_strFromWCS(
-        nullptr,
-        0,
-        nullptr,
-        log_msg.c_str(),
-        static_cast<int32_t>(log_msg.size()),
-        &u_err);
-    if (U_FAILURE(u_err))
+    if (arg == "end_of_batch")
     {
-        g_logger->error("ICU error: {}", u_errorName(u_err));
-        co_return std::unexpected(Error::todo);
+        return umb::FlushMode::end_of_batch;
     }
-    int32_t len;
-    const auto size_needed = *size_needed_result;
-    std::vector<UChar> buffer(size_needed);
-    u_strFromWCS(
-        buffer.data(),
-        size_needed,
-        &len,
-        log_msg.c_str(),
-        static_cast<int32_t>(log_msg.size()),
-        &u_err);
-    const auto log_msg_icu = icu::UnicodeString(
-        buffer.data(),
-        static_cast<int32_t>(buffer.size()));
-    std::string log_msg_str;
-    log_msg_icu.toUTF8String(log_msg_str);
-#endif
-    g_logger->info(log_msg_str);
-
-    const auto bytes_out = msg->to_bytes();
-    g_logger->info("bytes_out: {}", bytes_to_string(bytes_out, bytes_out.size()));
-    g_logger->info("bytes_out size: {}", bytes_out.size());
-    // Only count the number of payload bytes left here.
-    auto payload_bytes_left = bytes_out.size() - umb::g_header_size;
-    auto it_bytes_out = bytes_out.cbegin();
-
-    // Cache message type values, will be reused for all headers.
-    const auto mt0 = bytes_out[2];
-    const auto mt1 = bytes_out[3];
-
-    std::array<umb::byte, umb::g_packet_size> send_buf{};
-    umb::byte send_size = 0;
-    umb::byte send_part = 0;
-    unsigned num_from_buf = 0;
-
-    // TODO: REALLY CONSIDER ADDING HEADERS TO MULTIPART MESSAGE ENCODING
-    //       ALREADY IN THE ENCODING PHASE. THIS IS A LOT OF ADDED COMPLEXITY
-    //       TO PERFORM THE PACKAGE SPLITTING HERE.
-    // Send full parts while we have enough bytes left for them.
-    while (payload_bytes_left > (umb::g_packet_size - umb::g_header_size))
+    if (arg == "threshold")
     {
-        send_size = static_cast<umb::byte>(umb::g_packet_size);
-        send_buf[0] = send_size;
-        send_buf[1] = send_part++;
-        send_buf[2] = mt0;
-        send_buf[3] = mt1;
-
-        num_from_buf = send_size - umb::g_header_size;
-        std::copy_n(
-            it_bytes_out + umb::g_header_size,
-            num_from_buf,
-            send_buf.begin() + umb::g_header_size);
-        it_bytes_out += static_cast<umb::byte>(send_size - umb::g_header_size);
-
-        g_logger->info("sending {} bytes, send_part: {}, payload_bytes_left: {}, num_from_buf: {}",
-                       send_size, send_part, payload_bytes_left, num_from_buf);
-        const auto [sent_ec, num_sent] = co_await async_write(
-            socket,
-            boost::asio::buffer(send_buf, send_size),
-            as_tuple(deferred));
-
-        if (sent_ec != std::errc())
-        {
-            g_logger->error("async_write failed: {}, num_sent: {}",
-                            sent_ec.message(), num_sent);
-        }
-
-        g_logger->info("send_buf: {}", bytes_to_string(send_buf, send_size));
-
-        payload_bytes_left -= num_from_buf;
+        return umb::FlushMode::threshold;
     }
+    return std::nullopt;
+}
 
-    // Send the final non-full part.
-    // TODO: what is the 2nd check here?
-    if ((payload_bytes_left > 0) &&
-        (payload_bytes_left <= (umb::g_packet_size - umb::g_header_size)))
-    {
-        send_size = static_cast<umb::byte>(payload_bytes_left) + umb::g_header_size;
-        send_part = umb::g_part_multi_part_end;
-        send_buf[0] = send_size;
-        send_buf[1] = send_part;
-        send_buf[2] = mt0;
-        send_buf[3] = mt1;
-
-        num_from_buf = send_size - umb::g_header_size;
-        std::copy_n(
-            it_bytes_out + umb::g_header_size,
-            num_from_buf,
-            send_buf.begin() + umb::g_header_size);
-
-        // TODO: don't need to do this for last part?
-        //       Keep here to detect access beyond end (in debug builds?)?
-        it_bytes_out += send_size;
-
-        g_logger->info("sending {} bytes, send_part: {}, payload_bytes_left: {}, num_from_buf: {}",
-                       send_size, send_part, payload_bytes_left, num_from_buf);
-        const auto [sent_ec, num_sent] = co_await async_write(
-            socket,
-            boost::asio::buffer(send_buf, send_size),
-            deferred);
-
-        g_logger->info("send_buf: {}", bytes_to_string(send_buf, send_size));
-
-        if (sent_ec != std::errc())
-        {
-            g_logger->error("async_write failed: {}, num_sent: {}",
-                            sent_ec.message(), num_sent);
-        }
-    }
-    else
+// Parse a non-negative integer command line argument.
+template<typename T>
+std::optional<T> parse_uint(const std::string_view arg)
+{
+    T value{};
+    const auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+    if (ec != std::errc{} || ptr != arg.data() + arg.size())
     {
-        g_logger->error("ERROR: invalid number of bytes left for last part: {}!",
-                        payload_bytes_left);
+        return std::nullopt;
     }
-
-    // TODO: check bytes left is 0 here.
+    return value;
 }
 
-// TODO: close connection on bad data, error, etc.?
-awaitable<void> echo(tcp::socket socket)
+// Run \server until SIGINT or SIGTERM, then rethrow
+// the error that stopped a worker thread, if any.
+template<typename S>
+void run_until_signal(S& server)
 {
-    try
+    server.start();
+    g_logger->info("listening on port {} with {} threads",
+                   server.local_endpoint().port(), server.num_threads());
+
+    // Main thread only waits for signals.
+    boost::asio::io_context io_context(1);
+    boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+    signals.async_wait([&](auto, auto)
+                       {
+                           g_logger->info("exiting");
+                           io_context.stop();
+                       });
+
+    io_context.run();
+    server.stop();
+
+    if (const auto error = server.error())
     {
-        g_logger->info("connection: {}:{}",
-                       socket.remote_endpoint().address().to_string(),
-                       socket.remote_endpoint().port());
+        std::rethrow_exception(error);
+    }
+}
 
-        // TODO: should we read into a larger buffer?
-        std::array<umb::byte, umb::g_packet_size> data{};
+} // namespace
 
-        for (;;)
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        const auto mode = parse_flush_mode(argv[1]);
+        if (!mode)
         {
-            // 1. read 1 byte, it should be the packet size.
-            //   - if 255, we can expect to receive more than 255 bytes!
-            //     - next byte indicates part, value (0-254), 254 end marker always
-            //     - if part is 255, only a single part of size 255 expected
-            //   - elif < 255, expect only that amount
-            //     - part should always be 255
-
-            auto rh = read_header(socket, data);
-            const auto result = co_await rh.async_resume(use_awaitable);
-
-            if (!result.has_value())
-            {
-                const auto err = result.error();
-                // TODO: error messages.
-                g_logger->error("error: {}, closing connection\n",
-                                static_cast<int>(err));
-                break;
-            }
-
-            const auto header = *result;
-
-            // Parse UMB message.
-            // Serialize it to bytes, send it back.
-
-            print_header(header);
+            std::cout << std::format(
+                "usage: {} [immediate|end_of_batch|threshold] [num_threads] [asio|io_uring]"
+                " [trace_sample_every]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        g_flush_policy.mode = *mode;
+    }
 
-            // Part == 255       -> handle single-part read
-            // Part == 0         -> begin multipart read
-            // Part in [1, 253]  -> read multipart bytes
-            // Part == 254       -> end multipart read
+    // One worker per hardware thread by default.
+    umb::net::ServerOptions server_options{};
+    if (argc > 2)
+    {
+        const auto num_threads = parse_uint<std::size_t>(argv[2]);
+        if (!num_threads)
+        {
+            std::cout << std::format("invalid num_threads: {}\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        server_options.num_threads = *num_threads;
+    }
 
-            if (header.part == ::umb::g_part_single_part)
-            {
-                auto handle_single = handle_single_part_msg(socket, header.size, header.type, data);
-                const auto hs_result = co_await handle_single.async_resume(use_awaitable);
-                if (!hs_result.has_value())
-                {
-                    // TODO
-                }
-            }
-            else if (header.part == 0)
-            {
-                // TODO: should size always be 255 in this case?
-                //   - allow multi-part messages with only a single part,
-                //     where the part is smaller than 255?
-                //   - PROBABLY SHOULD NOT BE A THING!
-
-                // read parts into buffer until last part
-                auto handle_multi = handle_multi_part_msg(socket, header.size, header.type, data);
-                const auto hm_result = co_await handle_multi.async_resume(use_awaitable);
-                if (!hm_result.has_value())
-                {
-                    // TODO
-                }
-            }
-            else
+    bool use_io_uring = false;
+    if (argc > 3)
+    {
+        const std::string_view backend{argv[3]};
+        if (backend == "io_uring")
+        {
+            if (!UMB_NET_HAS_IO_URING)
             {
-                g_logger->error("error: unexpected part: {}", header.part);
-                continue; // Close conn?
+                std::cout << "built without io_uring support (UMB_WITH_IO_URING)\n";
+                return EXIT_FAILURE;
             }
+            use_io_uring = true;
+        }
+        else if (backend != "asio")
+        {
+            std::cout << std::format("invalid backend: {}\n", backend);
+            return EXIT_FAILURE;
         }
     }
-    catch (const std::exception& e)
-    {
-        g_logger->error("echo error: {}", e.what());
-    }
-}
 
-awaitable<void> listener()
-{
-    auto executor = co_await this_coro::executor;
-    tcp::acceptor acceptor(executor, {tcp::v4(), 55555});
-    for (;;)
+    // Trace every 64th message with a snapshot of its first packet,
+    // 0 disables tracing.
+    umb::TraceOptions trace_options{
+        .sample_every = 64,
+        .snapshot_bytes = umb::g_packet_size,
+    };
+    if (argc > 4)
     {
-        tcp::socket socket = co_await acceptor.async_accept(use_awaitable);
-        co_spawn(executor, echo(std::move(socket)), detached);
+        const auto sample_every = parse_uint<uint32_t>(argv[4]);
+        if (!sample_every)
+        {
+            std::cout << std::format("invalid trace_sample_every: {}\n", argv[4]);
+            return EXIT_FAILURE;
+        }
+        trace_options.sample_every = *sample_every;
     }
-}
+    g_tracer = std::make_unique<umb::Tracer>(trace_options);
 
-} // namespace
-
-int main()
-{
     try
     {
         spdlog::init_thread_pool(8192, 1);
@@ -647,20 +306,50 @@ int main()
         return EXIT_FAILURE;
     }
 
-    try
+    std::ofstream trace_out;
+    if (g_tracer->enabled())
     {
-        boost::asio::io_context io_context(1);
-
-        boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
-        signals.async_wait([&](auto, auto)
-                           {
-                               g_logger->info("exiting");
-                               io_context.stop();
-                           });
+        trace_out.open(g_trace_file, std::ios::binary | std::ios::trunc);
+        if (!trace_out)
+        {
+            g_logger->error("failed to open {}", g_trace_file);
+            return EXIT_FAILURE;
+        }
+        umb::write_trace_header(trace_out);
+    }
 
-        co_spawn(io_context, listener(), detached);
+    // Drains the per-thread trace buffers off the connection threads.
+    std::jthread trace_writer([&trace_out](const std::stop_token& stop)
+                              {
+                                  while (!stop.stop_requested())
+                                  {
+                                      std::this_thread::sleep_for(g_trace_drain_interval);
+                                      g_tracer->drain(trace_out);
+                                  }
+                              });
 
-        io_context.run();
+    try
+    {
+        if (use_io_uring)
+        {
+#if UMB_NET_HAS_IO_URING
+            umb::net::UringServer server{
+                {
+                    .server = server_options,
+                    .flush_policy = g_flush_policy,
+                },
+                EchoHandler{}};
+            run_until_signal(server);
+#endif
+        }
+        else
+        {
+            umb::net::Server server{server_options, [](tcp::socket socket)
+            {
+                return echo(std::move(socket));
+            }};
+            run_until_signal(server);
+        }
     }
     catch (const std::exception& e)
     {
@@ -673,5 +362,13 @@ int main()
         return EXIT_FAILURE;
     }
 
+    trace_writer.request_stop();
+    trace_writer.join();
+    g_tracer->drain(trace_out);
+    if (const auto dropped = g_tracer->dropped(); dropped > 0)
+    {
+        g_logger->warn("dropped {} trace records", dropped);
+    }
+
     return EXIT_SUCCESS;
 }
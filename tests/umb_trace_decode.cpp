@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2023-2024  Tuomo Kriikkula
+ * This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Prints a binary trace written by umb_echo_server as text,
+// one line per record in timestamp order.
+
+#include <algorithm>
+#include <clocale>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "umb/umb.hpp"
+#include "umb/trace.hpp"
+
+#include "TestMessages.umb.hpp"
+
+namespace
+{
+
+std::wstring type_name(uint16_t type)
+{
+#ifdef UMB_INCLUDE_META
+    const std::string name = testmessages::umb::meta::to_string(type);
+    if (!name.empty())
+    {
+        return {name.cbegin(), name.cend()};
+    }
+#endif
+    return std::to_wstring(type);
+}
+
+// Decoded message if the record holds all of it, raw snapshot bytes otherwise.
+std::wstring payload_string(const umb::TraceRecord& rec)
+{
+    if (rec.is_complete())
+    {
+        const auto msg = testmessages::umb::thread_message_pool().acquire(
+            static_cast<testmessages::umb::MessageType>(rec.type));
+        if (msg && msg->try_from_bytes(rec.snapshot_bytes()))
+        {
+            return msg->to_string();
+        }
+    }
+
+    std::wstring str = L"[";
+    for (const auto b: rec.snapshot_bytes())
+    {
+        str += std::format(L"{:02x}", +b);
+    }
+    str += L"]";
+    return str;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        std::cout << std::format("usage: {} TRACE_FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in)
+    {
+        std::cout << std::format("failed to open {}\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<umb::TraceRecord> records;
+    const auto result = umb::read_trace(in, [&records](const umb::TraceRecord& rec)
+    {
+        records.push_back(rec);
+    });
+
+    // Records of different threads are interleaved by drain order.
+    std::ranges::stable_sort(records, {}, &umb::TraceRecord::timestamp);
+
+    std::setlocale(LC_ALL, "");
+    for (const auto& rec: records)
+    {
+        std::wcout << std::format(L"{:%F %T} conn={} type={} size={} part={} parts={} {}\n",
+                                  rec.timestamp, rec.connection_id, type_name(rec.type),
+                                  +rec.size, +rec.part, rec.num_parts, payload_string(rec));
+    }
+
+    if (!result)
+    {
+        std::wcout << std::format(L"invalid trace file, error: {}\n", static_cast<int>(result.error()));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}